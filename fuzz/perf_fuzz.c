@@ -0,0 +1,426 @@
+// perf_fuzz.c
+// Cost-oracle fuzz target for acl_parse_string + acl_resolve_all + path lookups.
+//
+// Crashes are not the point here: an input is a finding when the time or the
+// allocation volume it costs per input byte exceeds a budget, or grows faster
+// than the input does. That is how the quadratic paths (array tail walks,
+// sibling label scans, field scans in the resolver) show up.
+//
+// Input layout: ACL text, optionally followed by a NUL byte and a list of
+// newline-separated lookup paths ("Network.interface[\"eth0\"].gateway").
+//
+// Per-byte budgets only catch blowups that are already large at the input's
+// size, so they miss a quadratic path on a 20 KB input. Inputs can therefore
+// mark repeat regions in the ACL text:
+//     //@repeat
+//         "mod",
+//     //@end
+// The markers are comments, so the input parses as-is. For such inputs the
+// regions are also repeated k and GROWTH_SCALE*k times (k sized so the smaller
+// copy is about GROWTH_BYTES) and the input fails if the cost grows like n^e
+// with e over the limit: e is about 1 for linear code, 2 for quadratic code.
+//
+// Two builds of the same file:
+//   make fuzz   libFuzzer target (clang). Over-budget inputs abort(), so the
+//               fuzzer saves them (add -close_fd_mask=2 to silence the
+//               library's parse errors); shrink one into the regression corpus with
+//                 build/perf_fuzz -minimize_crash=1 -runs=100000
+//                     -exact_artifact_path=fuzz/corpus/<name> crash-<sha>
+//               then wrap the part that repeats in //@repeat ... //@end so
+//               the replay checks how its cost grows.
+//   make bench  standalone replay of fuzz/corpus (or any files/directories
+//               given on the command line); exits 1 if anything is over budget.
+//
+// Budgets can be overridden with ACL_FUZZ_NS_PER_BYTE, ACL_FUZZ_ALLOCS_PER_BYTE,
+// ACL_FUZZ_HEAP_PER_BYTE and ACL_FUZZ_GROWTH.
+//
+// The library reports parse and resolution errors with exit(1) while holding
+// its parse lock. The build wraps exit() and pthread_mutex_lock/unlock
+// (-Wl,--wrap=...) so a rejected input unwinds back here and the lock is
+// released instead of ending the run.
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <setjmp.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "acl.h"
+
+#define DEFAULT_NS_PER_BYTE      1000.0
+#define DEFAULT_ALLOCS_PER_BYTE  2.0
+#define DEFAULT_HEAP_PER_BYTE    64.0
+#define SLACK_BYTES              256   /* fixed per-input allowance for tiny inputs */
+#define MAX_LOOKUPS              64
+#define MAX_PATH_LEN             512
+#define DEFAULT_GROWTH           1.5   /* max exponent e in cost ~ n^e */
+#define GROWTH_BYTES             32768
+#define GROWTH_SCALE             4
+#define REPEAT_BEGIN             "//@repeat"
+#define REPEAT_END               "//@end"
+
+//----------------------------------------------------------------
+// Allocation accounting and exit/lock interposition
+//----------------------------------------------------------------
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t k, size_t n);
+void *__real_realloc(void *p, size_t n);
+void  __real_exit(int code) __attribute__((noreturn));
+int   __real_pthread_mutex_lock(pthread_mutex_t *m);
+int   __real_pthread_mutex_unlock(pthread_mutex_t *m);
+
+static int      ARMED = 0;
+static size_t   ALLOCS = 0;
+static size_t   HEAP = 0;
+static int      BAILED = 0;
+static jmp_buf  BAIL;
+
+#define MAX_HELD 8
+static pthread_mutex_t *HELD[MAX_HELD];
+static int N_HELD = 0;
+
+void *__wrap_malloc(size_t n) {
+    if (ARMED) { ALLOCS++; HEAP += n; }
+    return __real_malloc(n);
+}
+void *__wrap_calloc(size_t k, size_t n) {
+    if (ARMED) { ALLOCS++; HEAP += k * n; }
+    return __real_calloc(k, n);
+}
+void *__wrap_realloc(void *p, size_t n) {
+    if (ARMED) { ALLOCS++; HEAP += n; }
+    return __real_realloc(p, n);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t *m) {
+    int rc = __real_pthread_mutex_lock(m);
+    if (rc == 0 && N_HELD < MAX_HELD) HELD[N_HELD++] = m;
+    return rc;
+}
+int __wrap_pthread_mutex_unlock(pthread_mutex_t *m) {
+    for (int i = N_HELD - 1; i >= 0; --i) {
+        if (HELD[i] == m) { HELD[i] = HELD[--N_HELD]; break; }
+    }
+    return __real_pthread_mutex_unlock(m);
+}
+
+void __wrap_exit(int code) {
+    if (ARMED) longjmp(BAIL, 1);
+    __real_exit(code);
+}
+
+static void release_held_locks(void) {
+    while (N_HELD > 0) __real_pthread_mutex_unlock(HELD[--N_HELD]);
+}
+
+//----------------------------------------------------------------
+// One measured run
+//----------------------------------------------------------------
+typedef struct {
+    double ns;
+    size_t allocs;
+    size_t heap;
+    int    rejected;   /* library bailed out with exit() */
+} Cost;
+
+static double env_budget(const char *name, double dflt) {
+    const char *s = getenv(name);
+    if (!s || !*s) return dflt;
+    double v = strtod(s, NULL);
+    return v > 0 ? v : dflt;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void run_lookups(AclBlock *root, const char *paths, size_t len) {
+    char path[MAX_PATH_LEN];
+    size_t i = 0;
+    for (int n = 0; n < MAX_LOOKUPS && i < len; ++n) {
+        size_t j = i;
+        while (j < len && paths[j] != '\n') j++;
+        size_t pl = j - i;
+        if (pl > 0 && pl < sizeof(path)) {
+            memcpy(path, paths + i, pl);
+            path[pl] = '\0';
+            long iv; double dv; int bv; char *sv = NULL;
+            acl_find_value_by_path(root, path);
+            acl_get_int(root, path, &iv);
+            acl_get_float(root, path, &dv);
+            acl_get_bool(root, path, &bv);
+            if (acl_get_string(root, path, &sv)) free(sv);
+        }
+        i = j + 1;
+    }
+}
+
+/* parse, resolve and query under the exit() trap; returns NULL if the library bailed */
+static AclBlock *guarded_run(const char *text, const char *paths, size_t paths_len) {
+    if (setjmp(BAIL) != 0) {
+        /* the tree under construction is abandoned; leaks are expected here */
+        release_held_locks();
+        BAILED = 1;
+        return NULL;
+    }
+    AclBlock *root = acl_parse_string(text);
+    if (root) {
+        acl_resolve_all(root);
+        run_lookups(root, paths, paths_len);
+    }
+    return root;
+}
+
+static Cost measure(const uint8_t *data, size_t size) {
+    /* split into NUL-terminated config text and the lookup section */
+    size_t text_len = 0;
+    while (text_len < size && data[text_len] != '\0') text_len++;
+    char *text = malloc(text_len + 1);
+    memcpy(text, data, text_len);
+    text[text_len] = '\0';
+    const char *paths = (const char *)data + text_len + 1;
+    size_t paths_len = text_len < size ? size - text_len - 1 : 0;
+
+    Cost c = {0, 0, 0, 0};
+    ALLOCS = 0; HEAP = 0; BAILED = 0;
+    double t0 = now_ns();
+    ARMED = 1;
+    AclBlock *root = guarded_run(text, paths, paths_len);
+    ARMED = 0;
+    c.rejected = BAILED;
+    c.ns = now_ns() - t0;
+    c.allocs = ALLOCS;
+    c.heap = HEAP;
+    if (root) acl_free(root);
+    free(text);
+    return c;
+}
+
+/* returns 1 and prints a report when `c` is over budget for an input of `size` bytes */
+static int over_budget(const char *name, size_t size, const Cost *c, FILE *out) {
+    double bytes = (double)size + SLACK_BYTES;
+    double ns_b = c->ns / bytes;
+    double al_b = (double)c->allocs / bytes;
+    double hp_b = (double)c->heap / bytes;
+    int bad = ns_b > env_budget("ACL_FUZZ_NS_PER_BYTE", DEFAULT_NS_PER_BYTE)
+           || al_b > env_budget("ACL_FUZZ_ALLOCS_PER_BYTE", DEFAULT_ALLOCS_PER_BYTE)
+           || hp_b > env_budget("ACL_FUZZ_HEAP_PER_BYTE", DEFAULT_HEAP_PER_BYTE);
+    if (out) {
+        fprintf(out, "%-32s %8zu B  %9.1f ns/B  %6.2f allocs/B  %8.1f heap/B  %s%s\n",
+                name, size, ns_b, al_b, hp_b,
+                bad ? "OVER BUDGET" : "ok", c->rejected ? " (rejected)" : "");
+    }
+    return bad;
+}
+
+//----------------------------------------------------------------
+// Growth check over //@repeat regions
+//----------------------------------------------------------------
+
+/* length of the marker line at s (up to and including '\n') if the line is
+   `marker` after optional indentation, else 0 */
+static size_t marker_line(const char *s, const char *end, const char *marker) {
+    const char *p = s;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    size_t ml = strlen(marker);
+    if ((size_t)(end - p) < ml || memcmp(p, marker, ml) != 0) return 0;
+    p += ml;
+    while (p < end && *p != '\n') p++;
+    return (size_t)(p - s) + (p < end);
+}
+
+/* Copies data with every repeat region written `k` times and the marker lines
+   dropped into a new buffer (NULL if `out` is NULL, only measuring). Returns
+   the output size; *region_bytes gets the size of one copy of all regions. */
+static size_t expand_regions(const uint8_t *data, size_t size, size_t k, uint8_t *out, size_t *region_bytes) {
+    const char *s = (const char *)data;
+    size_t text_len = 0;
+    while (text_len < size && data[text_len] != '\0') text_len++;
+    const char *end = s + text_len;
+
+    size_t n = 0, rb = 0;
+    const char *line = s;
+    const char *region = NULL;
+    while (line < end) {
+        const char *nl = memchr(line, '\n', (size_t)(end - line));
+        const char *next = nl ? nl + 1 : end;
+        size_t m;
+        if (!region && (m = marker_line(line, end, REPEAT_BEGIN))) {
+            region = line + m;
+            next = line + m;
+        } else if (region && (m = marker_line(line, end, REPEAT_END))) {
+            size_t len = (size_t)(line - region);
+            for (size_t i = 0; i < k; ++i, n += len) if (out) memcpy(out + n, region, len);
+            rb += len;
+            region = NULL;
+            next = line + m;
+        } else if (!region) {
+            size_t len = (size_t)(next - line);
+            if (out) memcpy(out + n, line, len);
+            n += len;
+        }
+        line = next;
+    }
+    if (region) { /* unterminated region: keep it as plain text */
+        size_t len = (size_t)(end - region);
+        if (out) memcpy(out + n, region, len);
+        n += len;
+    }
+
+    /* lookup section unchanged */
+    size_t rest = size - text_len;
+    if (out) memcpy(out + n, data + text_len, rest);
+    n += rest;
+    if (region_bytes) *region_bytes = rb;
+    return n;
+}
+
+static Cost measure_best(const uint8_t *data, size_t size, int runs) {
+    Cost best = measure(data, size);
+    for (int i = 1; i < runs; ++i) {
+        Cost c = measure(data, size);
+        if (c.ns < best.ns) best.ns = c.ns;
+    }
+    return best;
+}
+
+static Cost measure_scaled(const uint8_t *data, size_t size, size_t k, int runs, size_t *out_size) {
+    size_t n = expand_regions(data, size, k, NULL, NULL);
+    uint8_t *buf = malloc(n);
+    expand_regions(data, size, k, buf, NULL);
+    Cost c = measure_best(buf, n, runs);
+    free(buf);
+    *out_size = n;
+    return c;
+}
+
+typedef struct {
+    size_t n1, n2;           /* input sizes at k and GROWTH_SCALE*k repeats */
+    double ns, allocs, heap; /* growth exponents */
+} Growth;
+
+static double growth_exp(double c1, double c2) {
+    return log((c2 > 0 ? c2 : 1) / (c1 > 0 ? c1 : 1)) / log(GROWTH_SCALE);
+}
+
+/* measures inputs with repeat regions at k and GROWTH_SCALE*k; returns 0
+   (g unset) for inputs without regions or that the library rejects */
+static int growth_measure(const uint8_t *data, size_t size, int runs, Growth *g) {
+    size_t region = 0;
+    expand_regions(data, size, 1, NULL, &region);
+    if (region == 0) return 0;
+    size_t k = GROWTH_BYTES / region + 1;
+
+    Cost c1 = measure_scaled(data, size, k, runs, &g->n1);
+    Cost c2 = measure_scaled(data, size, GROWTH_SCALE * k, runs, &g->n2);
+    if (c1.rejected || c2.rejected) return 0;
+    g->ns = growth_exp(c1.ns, c2.ns);
+    g->allocs = growth_exp((double)c1.allocs, (double)c2.allocs);
+    g->heap = growth_exp((double)c1.heap, (double)c2.heap);
+    return 1;
+}
+
+static int growth_bad(const Growth *g) {
+    double limit = env_budget("ACL_FUZZ_GROWTH", DEFAULT_GROWTH);
+    return g->ns > limit || g->allocs > limit || g->heap > limit;
+}
+
+/* returns 1 and prints a report when cost grows faster than the input */
+static int over_growth(const char *name, const Growth *g, FILE *out) {
+    int bad = growth_bad(g);
+    if (out) {
+        fprintf(out, "%-32s %8zu B  n^%-5.2f time  n^%-4.2f allocs  n^%-5.2f heap  (to %zu B)  %s\n",
+                name, g->n1, g->ns, g->allocs, g->heap, g->n2, bad ? "OVER BUDGET" : "ok");
+    }
+    return bad;
+}
+
+#ifdef ACL_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Cost c = measure(data, size);
+    if (over_budget("input", size, &c, NULL)) {
+        /* re-measure once so a scheduler hiccup is not reported as a finding */
+        Cost again = measure(data, size);
+        if (again.ns < c.ns) c.ns = again.ns;
+        if (over_budget("input", size, &c, stderr)) abort();
+    }
+    /* same for the growth check: confirm with more runs before aborting */
+    Growth g;
+    if (!c.rejected && growth_measure(data, size, 1, &g) && growth_bad(&g)
+        && growth_measure(data, size, 3, &g) && over_growth("input", &g, stderr)) abort();
+    return 0;
+}
+
+#else
+
+#define REPLAY_RUNS 5
+
+static int replay_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror(path); return 1; }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (sz < 0) { fclose(f); return 1; }
+    uint8_t *buf = malloc((size_t)sz + 1);
+    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { fclose(f); free(buf); return 1; }
+    fclose(f);
+
+    /* best of several runs for time; allocation counts are deterministic */
+    Cost best = measure_best(buf, (size_t)sz, REPLAY_RUNS);
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    int bad = over_budget(name, (size_t)sz, &best, stdout);
+    Growth g;
+    if (growth_measure(buf, (size_t)sz, REPLAY_RUNS, &g)) {
+        /* confirm an over-limit ratio with more runs so noise is not reported */
+        if (growth_bad(&g)) growth_measure(buf, (size_t)sz, 3 * REPLAY_RUNS, &g);
+        bad |= over_growth(name, &g, stdout);
+    }
+    free(buf);
+    return bad;
+}
+
+static int replay_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) { perror(path); return 1; }
+    if (!S_ISDIR(st.st_mode)) return replay_file(path);
+
+    struct dirent **ents = NULL;
+    int n = scandir(path, &ents, NULL, alphasort);
+    if (n < 0) { perror(path); return 1; }
+    int bad = 0;
+    for (int i = 0; i < n; ++i) {
+        if (ents[i]->d_name[0] != '.') {
+            size_t len = strlen(path) + strlen(ents[i]->d_name) + 2;
+            char *full = malloc(len);
+            snprintf(full, len, "%s/%s", path, ents[i]->d_name);
+            bad |= replay_file(full);
+            free(full);
+        }
+        free(ents[i]);
+    }
+    free(ents);
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus-dir-or-file>...\n", argv[0]);
+        return 2;
+    }
+    int bad = 0;
+    for (int i = 1; i < argc; ++i) bad |= replay_path(argv[i]);
+    return bad ? 1 : 0;
+}
+
+#endif
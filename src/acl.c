@@ -3,6 +3,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include "acl.h"
 #include "expr.h"
 
@@ -43,6 +49,8 @@ typedef enum {
     TOK_COMMA,
     TOK_LBRACK,
     TOK_RBRACK,
+    TOK_LPAREN,
+    TOK_RPAREN,
 
     TOK_DOLLAR,
     TOK_DOT,
@@ -54,6 +62,8 @@ typedef enum {
     TOK_TYPE_STRING,
     TOK_TYPE_REF,
 
+    TOK_ARRAY_SPAN,   /* undecoded array literal, see scan_array_span */
+
     TOK_UNKNOWN
 } TokenKind;
 
@@ -65,6 +75,7 @@ typedef struct {
     int   bval;
     int   cval;
     size_t pos;
+    size_t end;    /* TOK_ARRAY_SPAN: offset just past the closing '}' */
     int line;
     int col;
 } Token;
@@ -75,6 +86,11 @@ static size_t SRC_POS = 0;
 static size_t SRC_LEN = 0;
 static int LINE = 1;
 static int COL = 1;
+static TokenKind PREV_KIND = TOK_EOF; /* kind of the last token lexed */
+
+/* Array literals at least this long (in bytes) are not decoded while
+   parsing; the field keeps the source span and decodes it on first use. */
+#define LAZY_ARRAY_MIN_BYTES 256
 
 static void adv_pos(char c) {
     if (c == '\n') { LINE++; COL = 1; } else COL++;
@@ -117,14 +133,114 @@ static int parse_escape_char(void) {
     }
 }
 
-static Token next_token_internal(void) {
+/* Fast scan over an array literal whose '{' is at SRC[from]: checks the token
+   structure (values separated by ',', nested braces) without building
+   tokens, so a span that decodes later cannot fail. Returns the offset just
+   past the closing '}', or 0 if the literal must be parsed now: it is short,
+   unterminated, holds anything but string/char/number/bool literals (refs,
+   builtin calls), or is malformed, in which case the eager parse reports the
+   error at load time. LINE/COL are advanced only on success. */
+static size_t scan_array_span(size_t from) {
+    size_t i = from + 1;
+    int depth = 1, lines = 0;
+    int want_value = 1, may_close = 1;  /* expecting a value; '}' allowed */
+    size_t line_start = 0;
+    while (i < SRC_LEN) {
+        char c = SRC[i];
+        if (c == '\n') { lines++; line_start = i + 1; i++; continue; }
+        if (isspace((unsigned char)c)) { i++; continue; }
+        if (c == '/' && i + 1 < SRC_LEN && SRC[i+1] == '/') {
+            while (i < SRC_LEN && SRC[i] != '\n') i++;
+            continue;
+        }
+        if (c == '/' && i + 1 < SRC_LEN && SRC[i+1] == '*') {
+            i += 2;
+            while (i + 1 < SRC_LEN && !(SRC[i] == '*' && SRC[i+1] == '/')) {
+                if (SRC[i] == '\n') { lines++; line_start = i + 1; }
+                i++;
+            }
+            if (i + 1 >= SRC_LEN) return 0;
+            i += 2;
+            continue;
+        }
+
+        if (c == '}') {
+            if (want_value && !may_close) return 0; /* "{ 1, }" */
+            want_value = 0;
+            if (--depth == 0) {
+                i++;
+                if (i - from < LAZY_ARRAY_MIN_BYTES) return 0;
+                if (lines) { LINE += lines; COL = (int)(i - line_start) + 1; }
+                else COL += (int)(i - from);
+                SRC_POS = i;
+                return i;
+            }
+            i++;
+            continue;
+        }
+        if (!want_value) {
+            if (c != ',') return 0;
+            want_value = 1; may_close = 0;
+            i++;
+            continue;
+        }
+
+        /* one value */
+        if (c == '{') {
+            depth++;
+            may_close = 1;
+            i++;
+            continue;
+        }
+        if (c == '"') {
+            i++;
+            while (i < SRC_LEN && SRC[i] != '"') {
+                if (SRC[i] == '\\' && i + 1 < SRC_LEN) i++;
+                if (SRC[i] == '\n') { lines++; line_start = i + 1; }
+                i++;
+            }
+            if (i >= SRC_LEN) return 0;
+            i++;
+        } else if (c == '\'') {
+            /* 'x' or '\x' only */
+            size_t n = (i + 1 < SRC_LEN && SRC[i+1] == '\\') ? 2 : 1;
+            if (i + n + 1 >= SRC_LEN || SRC[i+n+1] != '\'' || SRC[i+n] == '\n') return 0;
+            if (n == 1 && SRC[i+1] == '\'') return 0;
+            i += n + 2;
+        } else if (isdigit((unsigned char)c) || (c == '-' && i + 1 < SRC_LEN && isdigit((unsigned char)SRC[i+1]))) {
+            /* same shape as the lexer: -?digits[.digits] */
+            i++;
+            while (i < SRC_LEN && isdigit((unsigned char)SRC[i])) i++;
+            if (i < SRC_LEN && SRC[i] == '.') {
+                i++;
+                while (i < SRC_LEN && isdigit((unsigned char)SRC[i])) i++;
+            }
+        } else if (isalpha((unsigned char)c) || c == '_') {
+            size_t a = i;
+            while (i < SRC_LEN && (isalnum((unsigned char)SRC[i]) || SRC[i] == '_')) i++;
+            int is_bool = (i - a == 4 && memcmp(SRC + a, "true", 4) == 0)
+                       || (i - a == 5 && memcmp(SRC + a, "false", 5) == 0);
+            if (!is_bool) return 0;
+        } else {
+            return 0;
+        }
+        want_value = 0;
+    }
+    return 0;
+}
+
+static Token lex_token(void) {
     skip_spaces_and_comments();
     Token tk; memset(&tk,0,sizeof(tk));
     tk.pos = SRC_POS; tk.line = LINE; tk.col = COL;
     if (SRC_POS >= SRC_LEN) { tk.kind = TOK_EOF; return tk; }
     char c = peekc();
 
-    /* punctuation */
+    /* punctuation; a '{' right after '=' opens an array literal */
+    if (c == '{' && PREV_KIND == TOK_EQ) {
+        size_t end = scan_array_span(SRC_POS);
+        if (end) { tk.kind = TOK_ARRAY_SPAN; tk.end = end; return tk; }
+    }
     if (c == '{') { getc_src(); tk.kind = TOK_LBRACE; return tk; }
     if (c == '}') { getc_src(); tk.kind = TOK_RBRACE; return tk; }
     if (c == '=') { getc_src(); tk.kind = TOK_EQ; return tk; }
@@ -132,6 +248,8 @@ static Token next_token_internal(void) {
     if (c == ',') { getc_src(); tk.kind = TOK_COMMA; return tk; }
     if (c == '[') { getc_src(); tk.kind = TOK_LBRACK; return tk; }
     if (c == ']') { getc_src(); tk.kind = TOK_RBRACK; return tk; }
+    if (c == '(') { getc_src(); tk.kind = TOK_LPAREN; return tk; }
+    if (c == ')') { getc_src(); tk.kind = TOK_RPAREN; return tk; }
     if (c == '$') { getc_src(); tk.kind = TOK_DOLLAR; return tk; }
     if (c == '.') { getc_src(); tk.kind = TOK_DOT; return tk; }
     if (c == '^') { getc_src(); tk.kind = TOK_CARET; return tk; }
@@ -216,28 +334,37 @@ static Token next_token_internal(void) {
     return tk;
 }
 
+static Token next_token_internal(void) {
+    Token tk = lex_token();
+    PREV_KIND = tk.kind;
+    return tk;
+}
+
 static void token_free(Token *t) { if (!t) return; if (t->text) free(t->text); t->text = NULL; }
 
-/* ---------- parser buffer + safe snapshot lookahead ---------- */
+/* ---------- parser buffer + lookahead queue ---------- */
+
+/* Where the parser's tokens come from: the lexer itself, or the token ring
+   of a pipelined parse (see acl_parse_string_pipelined). The parser never
+   rewinds the lexer, so the two are interchangeable. */
+static Token (*TOKEN_SOURCE)(void) = next_token_internal;
 
 static Token BUF = {0};
 static int HAVE_BUF = 0;
-static Token SAVED = {0};
-static int HAVE_SAVED = 0;
+
+/* tokens fetched for lookahead but not consumed yet, oldest first */
+#define MAX_LOOKAHEAD 2
+static Token LOOK[MAX_LOOKAHEAD];
+static int N_LOOK = 0;
 
 static Token get_token_shared(void) {
-    if (HAVE_SAVED) {
-        Token t = SAVED;
-        HAVE_SAVED = 0;
+    if (N_LOOK) {
+        Token t = LOOK[0];
+        for (int i = 1; i < N_LOOK; ++i) LOOK[i-1] = LOOK[i];
+        N_LOOK--;
         return t;
     }
-    return next_token_internal();
-}
-
-static void push_token_shared(Token t) {
-    if (HAVE_SAVED) token_free(&SAVED);
-    SAVED = t;
-    HAVE_SAVED = 1;
+    return TOKEN_SOURCE();
 }
 
 static Token cur_token(void) {
@@ -258,57 +385,11 @@ static Token take_token(void) {
     return c;
 }
 
-typedef struct {
-    size_t src_pos;
-    int line;
-    int col;
-    int have_saved;
-    Token saved_copy;
-    int have_buf;
-    Token buf_copy;
-} Snapshot;
-
-static void snapshot_begin(Snapshot *S) {
-    S->src_pos = SRC_POS;
-    S->line = LINE;
-    S->col = COL;
-    S->have_saved = HAVE_SAVED;
-    if (S->have_saved) {
-        S->saved_copy = SAVED;
-        if (S->saved_copy.text) S->saved_copy.text = str_dup_local(SAVED.text);
-    } else { memset(&S->saved_copy,0,sizeof(Token)); }
-    S->have_buf = HAVE_BUF;
-    if (S->have_buf) {
-        S->buf_copy = BUF;
-        if (S->buf_copy.text) S->buf_copy.text = str_dup_local(BUF.text);
-    } else { memset(&S->buf_copy,0,sizeof(Token)); }
-}
-
-static void snapshot_restore(Snapshot *S) {
-    if (HAVE_BUF) token_free(&BUF);
-    if (HAVE_SAVED) token_free(&SAVED);
-    SRC_POS = S->src_pos;
-    LINE = S->line;
-    COL = S->col;
-    if (S->have_saved) {
-        SAVED = S->saved_copy; HAVE_SAVED = 1;
-    } else { HAVE_SAVED = 0; memset(&SAVED,0,sizeof(Token)); }
-    if (S->have_buf) {
-        BUF = S->buf_copy; HAVE_BUF = 1;
-    } else { HAVE_BUF = 0; memset(&BUF,0,sizeof(Token)); }
-}
-
 /* peek n tokens ahead (n>=1), return owned copy (caller must token_free) */
 static Token peek_n_safe(int n) {
-    Snapshot S; snapshot_begin(&S);
-    Token out = {0};
-    for (int i = 0; i < n; ++i) {
-        Token t = get_token_shared();
-        out = t;
-        if (out.text) out.text = str_dup_local(out.text);
-        if (i < n-1) token_free(&out);
-    }
-    snapshot_restore(&S);
+    while (N_LOOK < n) LOOK[N_LOOK++] = TOKEN_SOURCE();
+    Token out = LOOK[n-1];
+    if (out.text) out.text = str_dup_local(out.text);
     return out;
 }
 static Token peek1(void) { return peek_n_safe(1); }
@@ -318,6 +399,7 @@ static Token peek2(void) { return peek_n_safe(2); }
 
 static void show_line_context(size_t pos, int line, int col) {
     (void)line; /* unused */
+    if (!SRC) return; /* parse finished, the text is gone (see lex_end) */
     size_t i = pos;
     while (i > 0 && SRC[i-1] != '\n') i--;
     size_t j = i;
@@ -356,10 +438,11 @@ typedef struct {
     int col;
 } Ref;
 
-/* Value kinds (extended with VAL_REF and VAL_ARRAY) */
-typedef enum { VAL_INT, VAL_FLOAT, VAL_BOOL, VAL_STRING, VAL_CHAR, VAL_ARRAY, VAL_REF } ValKind;
+/* Value kinds (extended with VAL_REF, VAL_ARRAY, VAL_BLOCK and VAL_CALL) */
+typedef enum { VAL_INT, VAL_FLOAT, VAL_BOOL, VAL_STRING, VAL_CHAR, VAL_ARRAY, VAL_REF, VAL_BLOCK, VAL_CALL } ValKind;
 
 typedef struct ValueItem ValueItem;
+typedef struct Call Call;
 typedef struct Value {
     ValKind kind;
     long  ival;
@@ -372,11 +455,36 @@ typedef struct Value {
     ValueItem *arr;
     size_t arr_len;
 
+    /* undecoded array literal (source text of "{ ... }"); arr/arr_len are
+       filled in by value_force on first access */
+    char *lazy_src;
+    size_t lazy_len;
+    int lazy_line;
+    int lazy_col;
+
     /* ref */
     Ref *ref;
+
+    /* block handle from a resolved `ref` field (not owned) */
+    struct Block *blk;
+
+    /* builtin call waiting for its arguments to resolve */
+    Call *call;
 } Value;
 typedef struct ValueItem { Value v; struct ValueItem *next; } ValueItem;
 
+/* builtin function call, e.g. len($Modules.load); see "Builtin functions" */
+struct Call {
+    int fn;          /* index into BUILTINS */
+    Value *args;
+    size_t nargs;
+    int busy;        /* arguments being resolved; reaching it again is a cycle */
+
+    size_t pos;
+    int line;
+    int col;
+};
+
 
 static Value make_int(long x) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_INT; v.ival = x; return v; }
 static Value make_float(double x) { Value v; memset(&v,0,sizeof(v)); v.kind = VAL_FLOAT; v.fval = x; return v; }
@@ -441,27 +549,35 @@ static void value_free(Value *v) {
         }
         v->arr = NULL;
         v->arr_len = 0;
+        free(v->lazy_src);
+        v->lazy_src = NULL;
     }
     if (v->kind == VAL_REF) {
         if (v->ref) { ref_free(v->ref); v->ref = NULL; }
     }
+    if (v->kind == VAL_CALL && v->call) {
+        for (size_t i = 0; i < v->call->nargs; ++i) value_free(&v->call->args[i]);
+        free(v->call->args);
+        free(v->call);
+        v->call = NULL;
+    }
 }
 
-/* append to array value (takes ownership of item) */
-static void array_append(Value *arrv, Value item) {
+/* append to array value (takes ownership of item). `tail` caches the last
+   next-pointer between calls; start with it NULL. */
+static void array_append(Value *arrv, ValueItem ***tail, Value item) {
     if (!arrv || arrv->kind != VAL_ARRAY) return;
     ValueItem *node = malloc(sizeof(*node));
     node->v = item;
     node->next = NULL;
-    if (!arrv->arr) arrv->arr = node;
-    else {
-        ValueItem *it = arrv->arr;
-        while (it->next) it = it->next;
-        it->next = node;
-    }
+    if (!*tail) { *tail = &arrv->arr; while (**tail) *tail = &(**tail)->next; }
+    **tail = node;
+    *tail = &node->next;
     arrv->arr_len++;
 }
 
+static void value_force(Value *v); /* decode a lazy array literal, defined with the parser */
+
 /* ---------- printing values (including refs and arrays) ---------- */
 
 static void print_ref(const Ref *r) {
@@ -487,6 +603,9 @@ static void print_ref(const Ref *r) {
     }
 }
 
+static void print_block_path(const struct Block *b);
+static void print_call(const Call *c);
+
 static void print_value(const Value *v) {
     if (!v) return;
     switch (v->kind) {
@@ -500,6 +619,7 @@ static void print_value(const Value *v) {
             else printf("'%c'", (char)v->cval);
             break;
         case VAL_ARRAY: {
+            value_force((Value*)v);
             printf("[");
             ValueItem *it = v->arr;
             int first = 1;
@@ -515,13 +635,44 @@ static void print_value(const Value *v) {
         case VAL_REF:
             print_ref(v->ref);
             break;
+        case VAL_BLOCK:
+            print_block_path(v->blk);
+            break;
+        case VAL_CALL:
+            print_call(v->call);
+            break;
     }
 }
 
 /* ---------- AST: fields and blocks ---------- */
 
 typedef struct Field { char *type; char *name; Value value; struct Field *next; } Field;
-typedef struct Block { char *name; char *label; Field *fields; struct Block *children; struct Block *next; struct Block *parent; } Block;
+typedef struct ChildSlot { unsigned hash; int kind; struct Block *blk; } ChildSlot;
+typedef struct Block {
+    char *name; char *label; Field *fields; struct Block *children; struct Block *next; struct Block *parent;
+    Field **field_index;    /* open-addressed by name, see block_index_fields */
+    unsigned field_mask;
+    ChildSlot *child_index; /* by name, label and both, see block_index_children */
+    unsigned child_mask;
+} Block;
+
+/* defined with the resolver lookups */
+static void block_index_fields(Block *blk);
+static void block_index_children(Block *blk);
+
+/* print a block handle as <Name.child["label"]> */
+static void print_block_path(const Block *b) {
+    const Block *chain[64];
+    int n = 0;
+    for (const Block *p = b; p && n < 64; p = p->parent) chain[n++] = p;
+    printf("<");
+    for (int i = n - 1; i >= 0; --i) {
+        printf("%s", chain[i]->name);
+        if (chain[i]->label) printf("[\"%s\"]", chain[i]->label);
+        if (i) printf(".");
+    }
+    printf(">");
+}
 
 /* ---------- reference parsing helpers ---------- */
 
@@ -624,18 +775,20 @@ static Value parse_reference_value(void) {
     return make_int(0);
 }
 
-/* ---------- literal parsing (with arrays and refs) ---------- */
+/* ---------- literal parsing (with arrays, refs and builtin calls) ---------- */
 
 static Value parse_literal_value_final(void); /* forward */
+static Value parse_call_value(void);          /* defined with the builtins */
 
 static Value parse_array_literal_final(void) {
     consume_token(); /* consume '{' */
     Value arr = make_array();
+    ValueItem **tail = NULL;
     Token next = cur_token();
     if (next.kind == TOK_RBRACE) { consume_token(); return arr; }
     while (1) {
         Value item = parse_literal_value_final();
-        array_append(&arr, item);
+        array_append(&arr, &tail, item);
         Token sep = cur_token();
         if (sep.kind == TOK_COMMA) { consume_token(); continue; }
         if (sep.kind == TOK_RBRACE) { consume_token(); break; }
@@ -676,10 +829,20 @@ static Value parse_literal_value_final(void) {
         return v;
     }
     if (t.kind == TOK_LBRACE) return parse_array_literal_final();
+    if (t.kind == TOK_ARRAY_SPAN) {
+        Value v = make_array();
+        v.lazy_len = t.end - t.pos;
+        v.lazy_src = substr_dup(SRC, t.pos, t.end);
+        v.lazy_line = t.line;
+        v.lazy_col = t.col;
+        consume_token();
+        return v;
+    }
     if (t.kind == TOK_DOLLAR || t.kind == TOK_CARET) return parse_reference_value();
     /* support local $. handled in parse_reference_value */
+    if (t.kind == TOK_IDENT) return parse_call_value();
 
-    parse_error_token(&t, "literal (int, bool, string, char, array, or reference)");
+    parse_error_token(&t, "literal (int, bool, string, char, array, reference, or builtin call)");
     return make_int(0);
 }
 
@@ -766,7 +929,7 @@ static Block *parse_block_recursive(Block *parent) {
         if (cur.kind == TOK_EOF) parse_error_token(&cur, "unexpected EOF in block");
 
         /* typed field start */
-        if (cur.kind == TOK_TYPE_INT || cur.kind == TOK_TYPE_FLOAT || cur.kind == TOK_TYPE_BOOL || cur.kind == TOK_TYPE_STRING) {
+        if (cur.kind == TOK_TYPE_INT || cur.kind == TOK_TYPE_FLOAT || cur.kind == TOK_TYPE_BOOL || cur.kind == TOK_TYPE_STRING || cur.kind == TOK_TYPE_REF) {
             Field *f = parse_field_from_type_token(cur.kind);
             if (!blk->fields) blk->fields = f; else lastf->next = f;
             lastf = f;
@@ -808,20 +971,70 @@ static Block *parse_block_recursive(Block *parent) {
         parse_error_token(&cur, "typed field, inferred field, or child block");
     }
 
+    block_index_fields(blk);
+    block_index_children(blk);
     return blk;
 }
 
+/* ---------- lazy array decoding ---------- */
+
+/* Decode v's saved array literal in place. Runs the regular lexer/parser over
+   the saved text, so the caller must hold PARSE_LOCK; the parser state of an
+   enclosing parse is saved and restored around it. scan_array_span only keeps
+   literals the parser accepts, so this cannot hit a parse error. */
+static void array_decode(Value *v) {
+    const char *src = SRC; size_t pos = SRC_POS, len = SRC_LEN;
+    int line = LINE, col = COL;
+    TokenKind prev = PREV_KIND;
+    Token (*source)(void) = TOKEN_SOURCE;
+    Token buf = BUF, look[MAX_LOOKAHEAD];
+    int have_buf = HAVE_BUF, n_look = N_LOOK;
+    memcpy(look, LOOK, sizeof(LOOK));
+
+    SRC = v->lazy_src; SRC_POS = 0; SRC_LEN = v->lazy_len;
+    LINE = v->lazy_line; COL = v->lazy_col;
+    PREV_KIND = TOK_EOF;
+    TOKEN_SOURCE = next_token_internal;
+    HAVE_BUF = 0; N_LOOK = 0;
+    Value decoded = parse_array_literal_final();
+    if (HAVE_BUF) token_free(&BUF);
+
+    SRC = src; SRC_POS = pos; SRC_LEN = len;
+    LINE = line; COL = col;
+    PREV_KIND = prev;
+    TOKEN_SOURCE = source;
+    BUF = buf; HAVE_BUF = have_buf;
+    memcpy(LOOK, look, sizeof(LOOK)); N_LOOK = n_look;
+
+    v->arr = decoded.arr;
+    v->arr_len = decoded.arr_len;
+    char *text = v->lazy_src;
+    __atomic_store_n(&v->lazy_src, NULL, __ATOMIC_RELEASE);
+    free(text);
+}
+
 /* ---------- top-level parse ---------- */
 
-Block *parse_all(const char *text) {
+/* point the lexer at `text` and reset parser state */
+static void lex_begin(const char *text) {
     SRC = text;
     SRC_POS = 0;
     SRC_LEN = strlen(SRC);
     /* skip UTF-8 BOM if present */
     if (SRC_POS+3 <= SRC_LEN && (unsigned char)SRC[0]==0xEF && (unsigned char)SRC[1]==0xBB && (unsigned char)SRC[2]==0xBF) SRC_POS = 3;
     LINE = 1; COL = 1;
-    HAVE_BUF = 0; HAVE_SAVED = 0;
+    PREV_KIND = TOK_EOF;
+    HAVE_BUF = 0; N_LOOK = 0;
+}
+
+/* the caller frees the text after parsing; errors reported later (during
+   resolution) print line:col only */
+static void lex_end(void) {
+    SRC = NULL;
+    SRC_POS = SRC_LEN = 0;
+}
 
+static Block *parse_blocks(void) {
     Block *head = NULL, *last = NULL;
     for (;;) {
         Token t = cur_token();
@@ -837,6 +1050,107 @@ Block *parse_all(const char *text) {
     return head;
 }
 
+Block *parse_all(const char *text) {
+    lex_begin(text);
+    Block *root = parse_blocks();
+    lex_end();
+    return root;
+}
+
+/* ---------- pipelined parse ----------
+   The lexer runs on its own thread and hands tokens to the parser in
+   batches through a single-producer/single-consumer ring. Head and tail are
+   the only shared state: the lexer publishes filled batches by advancing
+   head, the parser returns drained ones by advancing tail. Both sides spin
+   briefly and then yield while the ring is full/empty.
+*/
+
+#define PIPE_BATCH 512   /* tokens per batch */
+#define PIPE_SLOTS 16    /* batches in flight; power of two */
+
+typedef struct { Token toks[PIPE_BATCH]; size_t n; } TokenBatch;
+
+typedef struct {
+    TokenBatch *slots;
+    size_t head __attribute__((aligned(64)));   /* batches published (lexer) */
+    size_t tail __attribute__((aligned(64)));   /* batches released (parser) */
+} TokenRing;
+
+static TokenRing *PIPE = NULL;
+static TokenBatch *PIPE_CUR = NULL;
+static size_t PIPE_IDX = 0;
+static Token PIPE_EOF;
+static int PIPE_DONE = 0;
+
+static void pipe_wait(int *spins) {
+    if (++*spins < 256) return;
+    *spins = 0;
+    sched_yield();
+}
+
+static void *pipe_lexer_main(void *arg) {
+    TokenRing *R = arg;
+    size_t head = 0;
+    for (;;) {
+        int spins = 0;
+        while (head - __atomic_load_n(&R->tail, __ATOMIC_ACQUIRE) >= PIPE_SLOTS) pipe_wait(&spins);
+        TokenBatch *b = &R->slots[head & (PIPE_SLOTS - 1)];
+        int eof = 0;
+        b->n = 0;
+        while (b->n < PIPE_BATCH) {
+            Token t = next_token_internal();
+            b->toks[b->n++] = t;
+            if (t.kind == TOK_EOF) { eof = 1; break; }
+        }
+        __atomic_store_n(&R->head, ++head, __ATOMIC_RELEASE);
+        if (eof) return NULL;
+    }
+}
+
+/* TOKEN_SOURCE for the parser side of a pipelined parse */
+static Token pipe_next_token(void) {
+    if (PIPE_DONE) return PIPE_EOF;
+    if (!PIPE_CUR || PIPE_IDX == PIPE_CUR->n) {
+        size_t tail = PIPE->tail;
+        if (PIPE_CUR) __atomic_store_n(&PIPE->tail, ++tail, __ATOMIC_RELEASE);
+        int spins = 0;
+        while (__atomic_load_n(&PIPE->head, __ATOMIC_ACQUIRE) == tail) pipe_wait(&spins);
+        PIPE_CUR = &PIPE->slots[tail & (PIPE_SLOTS - 1)];
+        PIPE_IDX = 0;
+    }
+    Token t = PIPE_CUR->toks[PIPE_IDX++];
+    if (t.kind == TOK_EOF) { PIPE_EOF = t; PIPE_DONE = 1; }
+    return t;
+}
+
+/* parse `text` with the lexer on a second thread; produces the same tree as
+   parse_all. Falls back to parse_all if the thread cannot be started. */
+static Block *parse_all_pipelined(const char *text) {
+    TokenRing R;
+    memset(&R, 0, sizeof(R));
+    R.slots = malloc(sizeof(TokenBatch) * PIPE_SLOTS);
+    if (!R.slots) return parse_all(text);
+
+    lex_begin(text);
+    PIPE = &R; PIPE_CUR = NULL; PIPE_IDX = 0; PIPE_DONE = 0;
+    pthread_t lexer;
+    if (pthread_create(&lexer, NULL, pipe_lexer_main, &R) != 0) {
+        free(R.slots);
+        PIPE = NULL;
+        Block *root = parse_blocks();
+        lex_end();
+        return root;
+    }
+    TOKEN_SOURCE = pipe_next_token;
+    Block *root = parse_blocks();
+    TOKEN_SOURCE = next_token_internal;
+    pthread_join(lexer, NULL);
+    PIPE = NULL; PIPE_CUR = NULL;
+    free(R.slots);
+    lex_end();
+    return root;
+}
+
 /* ---------- resolution helpers ---------- */
 
 /* deep copy value (owned copy) */
@@ -853,10 +1167,25 @@ static Value value_deep_copy(const Value *v) {
     r.ref = NULL;
     if (v->kind == VAL_STRING && v->sval) r.sval = str_dup_local(v->sval);
     if (v->kind == VAL_FLOAT) r.fval = v->fval;
-    if (v->kind == VAL_ARRAY) {
+    if (v->kind == VAL_BLOCK) r.blk = v->blk;
+    if (v->kind == VAL_CALL && v->call) {
+        Call *c = malloc(sizeof(*c));
+        *c = *v->call;
+        c->args = calloc(c->nargs ? c->nargs : 1, sizeof(Value));
+        for (size_t i = 0; i < c->nargs; ++i) c->args[i] = value_deep_copy(&v->call->args[i]);
+        r.call = c;
+    }
+    if (v->kind == VAL_ARRAY && v->lazy_src) {
+        /* copies of an undecoded literal stay undecoded */
+        r.lazy_src = substr_dup(v->lazy_src, 0, v->lazy_len);
+        r.lazy_len = v->lazy_len;
+        r.lazy_line = v->lazy_line;
+        r.lazy_col = v->lazy_col;
+    } else if (v->kind == VAL_ARRAY) {
+        ValueItem **tail = NULL;
         ValueItem *it = v->arr;
         while (it) {
-            array_append(&r, value_deep_copy(&it->v));
+            array_append(&r, &tail, value_deep_copy(&it->v));
             it = it->next;
         }
     }
@@ -864,6 +1193,9 @@ static Value value_deep_copy(const Value *v) {
         /* copy ref structure so unresolved refs remain independent */
         Ref *rf = ref_create(v->ref->scope);
         rf->parent_levels = v->ref->parent_levels;
+        rf->pos = v->ref->pos;
+        rf->line = v->ref->line;
+        rf->col = v->ref->col;
         RefSeg *src = v->ref->head;
         RefSeg **tail = &rf->head;
         while (src) {
@@ -877,29 +1209,136 @@ static Value value_deep_copy(const Value *v) {
     return r;
 }
 
-/* find first child block of `blk` with given name (favor first) */
-static Block *find_child_by_name(Block *blk, const char *name) {
-    if (!blk) return NULL;
+static unsigned name_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* Children are looked up by name, by label, or by both; blocks with at least
+   CHILD_INDEX_MIN children index all three so sibling lists are not scanned. */
+#define CHILD_INDEX_MIN 8
+enum { CHILD_BY_NAME, CHILD_BY_LABEL, CHILD_BY_BOTH };
+
+static int child_key(const char *name, const char *label) {
+    return name ? (label ? CHILD_BY_BOTH : CHILD_BY_NAME) : CHILD_BY_LABEL;
+}
+
+static unsigned child_hash(int kind, const char *name, const char *label) {
+    unsigned h = (unsigned)kind * 2654435761u;
+    if (name) h ^= name_hash(name);
+    if (label) h ^= name_hash(label) * 31u;
+    return h;
+}
+
+static int child_matches(const Block *c, int kind, const char *name, const char *label) {
+    if (kind != CHILD_BY_LABEL && !(c->name && strcmp(c->name, name) == 0)) return 0;
+    if (kind != CHILD_BY_NAME && !(c->label && strcmp(c->label, label) == 0)) return 0;
+    return 1;
+}
+
+static void child_index_put(ChildSlot *slots, unsigned mask, Block *c, int kind) {
+    const char *name = kind == CHILD_BY_LABEL ? NULL : c->name;
+    const char *label = kind == CHILD_BY_NAME ? NULL : c->label;
+    unsigned h = child_hash(kind, name, label);
+    unsigned i = h & mask;
+    for (; slots[i].blk; i = (i + 1) & mask) {
+        if (slots[i].hash == h && slots[i].kind == kind
+         && child_matches(slots[i].blk, kind, name, label)) return; /* favor first */
+    }
+    slots[i].hash = h;
+    slots[i].kind = kind;
+    slots[i].blk = c;
+}
+
+static void block_index_children(Block *blk) {
+    free(blk->child_index);
+    blk->child_index = NULL;
+    blk->child_mask = 0;
+
+    size_t n = 0;
+    for (Block *c = blk->children; c; c = c->next) n++;
+    if (n < CHILD_INDEX_MIN) return;
+
+    unsigned cap = 16;
+    while (cap < n * 6) cap <<= 1; /* up to three keys per child */
+    ChildSlot *slots = calloc(cap, sizeof(ChildSlot));
+    if (!slots) return; /* lookups fall back to scanning */
     for (Block *c = blk->children; c; c = c->next) {
-        if (c->name && name && strcmp(c->name, name) == 0) return c;
+        if (c->name) child_index_put(slots, cap - 1, c, CHILD_BY_NAME);
+        if (c->label) child_index_put(slots, cap - 1, c, CHILD_BY_LABEL);
+        if (c->name && c->label) child_index_put(slots, cap - 1, c, CHILD_BY_BOTH);
+    }
+    blk->child_index = slots;
+    blk->child_mask = cap - 1;
+}
+
+/* first child of `blk` matching name and/or label (whichever are non-NULL) */
+static Block *find_child(const Block *blk, const char *name, const char *label) {
+    if (!blk || (!name && !label)) return NULL;
+    int kind = child_key(name, label);
+    if (blk->child_index) {
+        unsigned h = child_hash(kind, name, label);
+        for (unsigned i = h & blk->child_mask; blk->child_index[i].blk; i = (i + 1) & blk->child_mask) {
+            const ChildSlot *sl = &blk->child_index[i];
+            if (sl->hash == h && sl->kind == kind && child_matches(sl->blk, kind, name, label)) return sl->blk;
+        }
+        return NULL;
+    }
+    for (Block *c = blk->children; c; c = c->next) {
+        if (child_matches(c, kind, name, label)) return c;
     }
     return NULL;
 }
 
+/* find first child block of `blk` with given name (favor first) */
+static Block *find_child_by_name(Block *blk, const char *name) {
+    return find_child(blk, name, NULL);
+}
+
 /* find first child block of `blk` with given name and label */
 static Block *find_child_by_name_and_label(Block *blk, const char *name, const char *label) {
-    if (!blk) return NULL;
-    for (Block *c = blk->children; c; c = c->next) {
-        if (c->name && name && strcmp(c->name, name) == 0) {
-            if (c->label && label && strcmp(c->label, label) == 0) return c;
-        }
+    if (!name || !label) return NULL;
+    return find_child(blk, name, label);
+}
+
+/* Blocks with at least FIELD_INDEX_MIN fields get a name index, so resolving
+   references and looking up paths does not scan the field list. Rebuild it
+   whenever fields are added after parsing. */
+#define FIELD_INDEX_MIN 8
+
+static void block_index_fields(Block *blk) {
+    free(blk->field_index);
+    blk->field_index = NULL;
+    blk->field_mask = 0;
+
+    size_t n = 0;
+    for (Field *f = blk->fields; f; f = f->next) n++;
+    if (n < FIELD_INDEX_MIN) return;
+
+    unsigned cap = 16;
+    while (cap < n * 2) cap <<= 1;
+    Field **slots = calloc(cap, sizeof(Field*));
+    if (!slots) return; /* lookups fall back to scanning */
+    for (Field *f = blk->fields; f; f = f->next) {
+        if (!f->name) continue;
+        unsigned i = name_hash(f->name) & (cap - 1);
+        while (slots[i] && strcmp(slots[i]->name, f->name) != 0) i = (i + 1) & (cap - 1);
+        if (!slots[i]) slots[i] = f; /* favor first */
     }
-    return NULL;
+    blk->field_index = slots;
+    blk->field_mask = cap - 1;
 }
 
 /* find field by name in block (favor first) */
 static Field *find_field_in_block(Block *blk, const char *name) {
-    if (!blk) return NULL;
+    if (!blk || !name) return NULL;
+    if (blk->field_index) {
+        unsigned i = name_hash(name) & blk->field_mask;
+        for (Field *f; (f = blk->field_index[i]); i = (i + 1) & blk->field_mask)
+            if (strcmp(f->name, name) == 0) return f;
+        return NULL;
+    }
     for (Field *f = blk->fields; f; f = f->next) {
         if (f->name && name && strcmp(f->name, name) == 0) return f;
     }
@@ -917,28 +1356,22 @@ static void resolution_error_and_exit(const Ref *r) {
     exit(1);
 }
 
-/* resolve a Ref into a Value copy, given root list and current block context.
-   Returns 1 on success and stores copied value in out (caller must value_free), 0 on failure.
-   Ambiguities favor first match. depth limits prevent runaway recursion. */
-/* resolve a Ref into out (deep‐copy), or abort on any failure */
-static int resolve_ref_to_value(const Block *root_list,
-                                const Block *current_block,
-                                const Ref       *r,
-                                Value           *out,
-                                int              depth)
+/* Walk a Ref from its starting block, given root list and current block context.
+   Returns the field named by the last segment (block set to its owner), or
+   with *field NULL the block the path ends on. Returns NULL with *field NULL
+   if the path steps through a `ref` field that is not resolved yet (a later
+   pass may succeed; one still waiting after the last pass is reported by
+   check_resolved_block). Ambiguities favor first match; any other failure aborts. */
+static const Block *resolve_ref_target(const Block *root_list,
+                                       const Block *current_block,
+                                       const Ref   *r,
+                                       Field      **field,
+                                       int          depth)
 {
-    if (!r || !out) resolution_error_and_exit(r);
+    if (!r || !field) resolution_error_and_exit(r);
     if (depth > 64)  resolution_error_and_exit(r);
 
-    memset(out, 0, sizeof(*out));
-
-    /* helper to copy a field value into out */
-    int try_field_copy(const Block *blk, const char *field_name) {
-        Field *f = find_field_in_block((Block*)blk, field_name);
-        if (!f) return 0;
-        *out = value_deep_copy(&f->value);
-        return 1;
-    }
+    *field = NULL;
 
     /* pick starting block */
     const Block *pos = NULL;
@@ -975,14 +1408,7 @@ static int resolve_ref_to_value(const Block *root_list,
 
         if (seg->is_index) {
             /* select first child whose label matches */
-            const Block *found = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->label && strcmp(c->label, seg->index) == 0) {
-                    found = c;
-                    break;
-                }
-            }
-            pos = found;
+            pos = find_child(pos, NULL, seg->index);
             seg = seg->next;
             continue;
         }
@@ -991,57 +1417,86 @@ static int resolve_ref_to_value(const Block *root_list,
         RefSeg *next = seg->next;
         if (next && next->is_index) {
             /* name + index pair: find child by (name,label) */
-            const char *lbl = next->index;
-            const Block *found = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->name && strcmp(c->name, seg->name) == 0
-                 && c->label && strcmp(c->label, lbl) == 0) {
-                    found = c;
-                    break;
-                }
-            }
-            pos = found;
+            pos = find_child(pos, seg->name, next->index);
             seg = next->next;  /* skip both */
             continue;
         }
         else {
             /* lone name: pick first child block with that name */
-            const Block *child = NULL;
-            for (const Block *c = pos->children; c; c = c->next) {
-                if (c->name && strcmp(c->name, seg->name) == 0) {
-                    child = c;
-                    break;
-                }
-            }
+            const Block *child = find_child(pos, seg->name, NULL);
             if (child) {
                 pos = child;
                 seg = seg->next;
                 continue;
             }
-            /* if final segment, try it as a field name */
+            Field *f = find_field_in_block((Block*)pos, seg->name);
+            /* if final segment, it names a field */
             if (seg->next == NULL) {
-                if (try_field_copy(pos, seg->name)) {
-                    return 1;
-                }
+                if (f) { *field = f; return pos; }
                 resolution_error_and_exit(r);
             }
+            /* intermediate name may be a block handle held by a `ref` field */
+            if (f && f->value.kind == VAL_BLOCK) {
+                pos = f->value.blk;
+                seg = seg->next;
+                continue;
+            }
+            if (f && f->value.kind == VAL_REF) return NULL;
             /* intermediate name not found → error */
             resolution_error_and_exit(r);
         }
     }
 
-    /* if we consumed all segments and landed on a block, that's not a field → error */
-    resolution_error_and_exit(r);
-    return 0; /* unreachable */
+    if (!pos) resolution_error_and_exit(r);
+    return pos;
+}
+
+static int resolve_value_deep(const Block *root_list, Block *field_block, Value *v, int allow_block);
+static void builtin_error(const Call *c, const char *msg);
+
+/* resolve a Ref into out (deep‐copy of the target field, or a block handle
+   when allow_block is set and the path ends on a block). Returns 1 on
+   success (caller must value_free out), 0 if the target is not resolvable
+   yet; aborts on any other failure. */
+static int resolve_ref_to_value(const Block *root_list,
+                                const Block *current_block,
+                                const Ref       *r,
+                                Value           *out,
+                                int              depth,
+                                int              allow_block)
+{
+    if (!r || !out) resolution_error_and_exit(r);
+    memset(out, 0, sizeof(*out));
+
+    Field *f = NULL;
+    const Block *target = resolve_ref_target(root_list, current_block, r, &f, depth);
+    if (f) {
+        /* a call is evaluated first, in its own block; if its arguments are
+           not ready either, wait for a later pass */
+        if (f->value.kind == VAL_CALL) {
+            if (f->value.call->busy) builtin_error(f->value.call, "depends on its own result");
+            resolve_value_deep(root_list, (Block*)target, &f->value, 0);
+            if (f->value.kind == VAL_CALL) return 0;
+        }
+        *out = value_deep_copy(&f->value);
+        return 1;
+    }
+    if (!target) return 0;
+
+    /* landed on a block: only `ref` fields may hold one */
+    if (!allow_block) resolution_error_and_exit(r);
+    out->kind = VAL_BLOCK;
+    out->blk = (Block*)target;
+    return 1;
 }
 
 /* attempt to resolve a single Value if it's VAL_REF; uses block context (the block that owns the field).
    Returns 1 if replaced (and out value is set into field), 0 if nothing changed. */
-static int try_resolve_value_for_field(const Block *root_list, Block *field_block, Value *v, int depth) {
+static int try_resolve_value_for_field(const Block *root_list, Block *field_block, Value *v, int depth, int allow_block) {
     if (!v) return 0;
     if (v->kind != VAL_REF) return 0;
     Value resolved;
-    if (resolve_ref_to_value(root_list, field_block, v->ref, &resolved, depth+1)) {
+    if (resolve_ref_to_value(root_list, field_block, v->ref, &resolved, depth+1, allow_block)) {
         /* replace v with resolved (take ownership of resolved) */
         /* free original ref */
         value_free(v);
@@ -1051,6 +1506,51 @@ static int try_resolve_value_for_field(const Block *root_list, Block *field_bloc
     return 0;
 }
 
+static int value_is_constant(const Value *v);
+static Value call_eval(const Call *c);
+
+/* after the last pass: a reference still unresolved (it is part of a cycle)
+   or a call still waiting for its arguments can never be evaluated */
+static void check_resolved_value(const Value *v) {
+    if (v->kind == VAL_ARRAY) {
+        for (const ValueItem *it = v->arr; it; it = it->next) check_resolved_value(&it->v);
+    } else if (v->kind == VAL_REF) {
+        resolution_error_and_exit(v->ref);
+    } else if (v->kind == VAL_CALL) {
+        for (size_t i = 0; i < v->call->nargs; ++i) check_resolved_value(&v->call->args[i]);
+        builtin_error(v->call, "arguments never resolve");
+    }
+}
+
+static void check_resolved_block(const Block *b) {
+    for (const Field *f = b->fields; f; f = f->next) check_resolved_value(&f->value);
+    for (const Block *c = b->children; c; c = c->next) check_resolved_block(c);
+}
+
+/* resolve references anywhere inside v (array elements, call arguments) and
+   evaluate builtin calls once all their arguments are resolved.
+   Returns 1 if anything changed. */
+static int resolve_value_deep(const Block *root_list, Block *field_block, Value *v, int allow_block) {
+    if (v->kind == VAL_REF) return try_resolve_value_for_field(root_list, field_block, v, 0, allow_block);
+    int changed = 0;
+    if (v->kind == VAL_ARRAY) {
+        for (ValueItem *it = v->arr; it; it = it->next)
+            changed |= resolve_value_deep(root_list, field_block, &it->v, allow_block);
+    } else if (v->kind == VAL_CALL) {
+        v->call->busy = 1;
+        for (size_t i = 0; i < v->call->nargs; ++i)
+            changed |= resolve_value_deep(root_list, field_block, &v->call->args[i], 0);
+        v->call->busy = 0;
+        if (value_is_constant(v)) {
+            Value result = call_eval(v->call);
+            value_free(v);
+            *v = result;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
 /* Walk tree and resolve all field VAL_REF values, using containing block as context.
    This is iterative but will attempt to resolve nested references by multiple passes up to a limit. */
 void resolve_all_refs(Block *root) {
@@ -1082,28 +1582,19 @@ void resolve_all_refs(Block *root) {
 
                 // now resolve each field in this block
                 for (Field *f = cur->fields; f; f = f->next) {
+                    // `ref` fields may also point at whole blocks
+                    int allow_block = f->type && strcmp(f->type, "ref") == 0;
 
-                    // 1) resolve any VAL_REF in scalars
-                    if (f->value.kind == VAL_REF) {
-                        if (try_resolve_value_for_field(root, cur, &f->value, 0)) {
+                    // 1) resolve any VAL_REF in scalars, array elements and call
+                    //    arguments; evaluate calls whose arguments are ready
+                    if (f->value.kind == VAL_REF || f->value.kind == VAL_ARRAY || f->value.kind == VAL_CALL) {
+                        if (resolve_value_deep(root, cur, &f->value, allow_block)) {
                             any_changed = 1;
                             // after a ref resolves, it may produce new refs/arrays
                         }
                     }
-                    // 2) resolve refs inside array elements
-                    else if (f->value.kind == VAL_ARRAY) {
-                        ValueItem *it = f->value.arr;
-                        while (it) {
-                            if (it->v.kind == VAL_REF) {
-                                if (try_resolve_value_for_field(root, cur, &it->v, 0)) {
-                                    any_changed = 1;
-                                }
-                            }
-                            it = it->next;
-                        }
-                    }
 
-                    // 3) evaluate any expression fields
+                    // 2) evaluate any expression fields
                     //    - we conventionally declare them as type "expr"
                     //    - their raw value was parsed as a string literal
                     else if (f->type
@@ -1136,6 +1627,9 @@ void resolve_all_refs(Block *root) {
         // if we made no progress on this pass, stop early
         if (!any_changed) break;
     }
+
+    // lookups must only ever see computed values
+    for (Block *b = root; b; b = b->next) check_resolved_block(b);
 }
 
 /* ---------- printing/freeing ---------- */
@@ -1168,6 +1662,8 @@ void free_blocks(Block *b) {
         Block *nb = b->next;
         if (b->name) free(b->name);
         if (b->label) free(b->label);
+        free(b->field_index);
+        free(b->child_index);
         for (Field *f = b->fields; f; ) {
             Field *nf = f->next;
             if (f->type) free(f->type);
@@ -1191,6 +1687,17 @@ extern void resolve_all_refs(Block *root);
 extern void print_all(const Block *root);
 extern void free_blocks(Block *root);
 
+/* The parser, lexer and expression evaluator keep their state in globals,
+   so every entry point that drives them runs under this lock. */
+static pthread_mutex_t PARSE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static void value_force(Value *v) {
+    if (!v || v->kind != VAL_ARRAY || !__atomic_load_n(&v->lazy_src, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&PARSE_LOCK);
+    if (v->lazy_src) array_decode(v);
+    pthread_mutex_unlock(&PARSE_LOCK);
+}
+
 /* -----------------------------
    Public API wrappers
    ----------------------------- */
@@ -1203,34 +1710,73 @@ void acl_shutdown(void) {
     /* No-op for now */
 }
 
-AclBlock *acl_parse_file(const char *path) {
-    if (!path) return NULL;
-    FILE *f = fopen(path, "rb");
-    if (!f) { perror("fopen"); return NULL; }
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return NULL; }
+/* read the rest of an open file into a NUL-terminated heap buffer */
+static char *read_stream(FILE *f) {
+    if (fseek(f, 0, SEEK_END) != 0) return NULL;
     long sz = ftell(f);
-    if (sz < 0) { fclose(f); return NULL; }
-    if (fseek(f, 0, SEEK_SET) != 0) { fclose(f); return NULL; }
+    if (sz < 0) return NULL;
+    if (fseek(f, 0, SEEK_SET) != 0) return NULL;
     char *buf = malloc((size_t)sz + 1);
-    if (!buf) { fclose(f); return NULL; }
-    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { free(buf); fclose(f); return NULL; }
+    if (!buf) return NULL;
+    if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { free(buf); return NULL; }
     buf[sz] = '\0';
+    return buf;
+}
+
+/* read a whole file into a NUL-terminated heap buffer */
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror("fopen"); return NULL; }
+    char *buf = read_stream(f);
     fclose(f);
+    return buf;
+}
+
+AclBlock *acl_parse_file(const char *path) {
+    if (!path) return NULL;
+    char *buf = read_file(path);
+    if (!buf) return NULL;
 
+    pthread_mutex_lock(&PARSE_LOCK);
     Block *root = parse_all(buf);
+    pthread_mutex_unlock(&PARSE_LOCK);
     free(buf);
     return (AclBlock*)root;
 }
 
+AclBlock *acl_parse_file_pipelined(const char *path) {
+    if (!path) return NULL;
+    char *buf = read_file(path);
+    if (!buf) return NULL;
+
+    pthread_mutex_lock(&PARSE_LOCK);
+    Block *root = parse_all_pipelined(buf);
+    pthread_mutex_unlock(&PARSE_LOCK);
+    free(buf);
+    return (AclBlock*)root;
+}
+
+AclBlock *acl_parse_string_pipelined(const char *text) {
+    if (!text) return NULL;
+    pthread_mutex_lock(&PARSE_LOCK);
+    Block *root = parse_all_pipelined(text);
+    pthread_mutex_unlock(&PARSE_LOCK);
+    return (AclBlock*)root;
+}
+
 AclBlock *acl_parse_string(const char *text) {
     if (!text) return NULL;
+    pthread_mutex_lock(&PARSE_LOCK);
     Block *root = parse_all(text);
+    pthread_mutex_unlock(&PARSE_LOCK);
     return (AclBlock*)root;
 }
 
 int acl_resolve_all(AclBlock *root) {
     if (!root) return 0;
+    pthread_mutex_lock(&PARSE_LOCK);
     resolve_all_refs((Block*)root);
+    pthread_mutex_unlock(&PARSE_LOCK);
     return 1;
 }
 
@@ -1245,6 +1791,118 @@ void acl_free(AclBlock *root) {
     free_blocks((Block*)root);
 }
 
+/* ---------------------------
+   Process-wide shared tree cache
+   ---------------------------
+   Entries are keyed by (path, device, inode, mtime, size) so an edited file
+   gets a fresh entry while holders of the old tree keep using it. An entry
+   lives exactly as long as it has references; the first opener parses and
+   resolves while later openers of the same key wait for that result.
+*/
+
+typedef struct SharedEntry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    int refs;
+    int loading;   /* parse in flight; waiters sleep on SHARED_COND */
+    Block *root;   /* NULL after a failed load */
+    struct SharedEntry *next;
+} SharedEntry;
+
+static pthread_mutex_t SHARED_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t SHARED_COND = PTHREAD_COND_INITIALIZER;
+static SharedEntry *SHARED = NULL;
+
+static int shared_entry_matches(const SharedEntry *e, const char *path, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size
+        && e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec
+        && strcmp(e->path, path) == 0;
+}
+
+/* unlink e from the cache; caller holds SHARED_LOCK */
+static void shared_entry_unlink(SharedEntry *e) {
+    for (SharedEntry **pp = &SHARED; *pp; pp = &(*pp)->next) {
+        if (*pp == e) { *pp = e->next; return; }
+    }
+}
+
+/* drop one reference; frees the entry and its tree when it was the last.
+   Caller holds SHARED_LOCK; the tree itself is freed after unlocking. */
+static Block *shared_entry_put(SharedEntry *e) {
+    if (--e->refs > 0) return NULL;
+    shared_entry_unlink(e);
+    Block *root = e->root;
+    free(e->path);
+    free(e);
+    return root;
+}
+
+AclBlock *acl_open_shared(const char *path) {
+    if (!path) return NULL;
+    /* key the entry on the descriptor we parse from, so a file replaced
+       between the stat and the read cannot pair old metadata with new text */
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror("fopen"); return NULL; }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) { perror("fstat"); fclose(f); return NULL; }
+
+    pthread_mutex_lock(&SHARED_LOCK);
+    SharedEntry *e = SHARED;
+    while (e && !(shared_entry_matches(e, path, &st) && (e->loading || e->root))) e = e->next;
+    if (e) {
+        e->refs++;
+        while (e->loading) pthread_cond_wait(&SHARED_COND, &SHARED_LOCK);
+        Block *root = e->root;
+        if (!root) shared_entry_put(e);
+        pthread_mutex_unlock(&SHARED_LOCK);
+        fclose(f);
+        return (AclBlock*)root;
+    }
+
+    e = malloc(sizeof(*e));
+    char *key = str_dup_local(path);
+    if (!e || !key) { free(e); free(key); pthread_mutex_unlock(&SHARED_LOCK); fclose(f); return NULL; }
+    memset(e, 0, sizeof(*e));
+    e->path = key;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->size = st.st_size;
+    e->refs = 1;
+    e->loading = 1;
+    e->next = SHARED;
+    SHARED = e;
+    pthread_mutex_unlock(&SHARED_LOCK);
+
+    char *text = read_stream(f);
+    fclose(f);
+    AclBlock *root = text ? acl_parse_string(text) : NULL;
+    free(text);
+    if (root) acl_resolve_all(root);
+
+    pthread_mutex_lock(&SHARED_LOCK);
+    e->root = (Block*)root;
+    e->loading = 0;
+    if (!root) shared_entry_put(e);
+    pthread_cond_broadcast(&SHARED_COND);
+    pthread_mutex_unlock(&SHARED_LOCK);
+    return root;
+}
+
+void acl_release_shared(AclBlock *root) {
+    if (!root) return;
+    Block *dead = NULL;
+    pthread_mutex_lock(&SHARED_LOCK);
+    for (SharedEntry *e = SHARED; e; e = e->next) {
+        if (e->root == (Block*)root) { dead = shared_entry_put(e); break; }
+    }
+    pthread_mutex_unlock(&SHARED_LOCK);
+    if (dead) free_blocks(dead);
+}
+
 void acl_error_free(AclError *err) {
     if (!err) return;
     if (err->message) free(err->message);
@@ -1338,14 +1996,62 @@ static int parse_segment_with_index(const char *seg, char **out_name, char **out
     return 1;
 }
 
-/* Find a Value* given a path with optional numeric indexing.
-   Returns pointer to Value inside tree (do not free) or NULL if not found/parse error.
-*/
-AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
-    if (!root || !path) return NULL;
+/* Select the next block below cur_block for an intermediate (or, with
+   want_block, final) path segment. Besides child blocks, a field holding a
+   block handle (a resolved `ref` field) can be stepped through by name, and
+   an element of a `ref[]` array by name and index. */
+static Block *path_step(Block *top, Block *cur_block, const char *name, const char *label, int index) {
+    Block *next = NULL;
+    if (label && name) {
+        next = find_child_by_name_and_label(cur_block, name, label);
+    } else if (label && !name) {
+        /* choose first child whose label matches */
+        next = find_child(cur_block, NULL, label);
+    } else if (name && !label) {
+        /* first child with that name, else a block handle stored under that name */
+        next = find_child_by_name(cur_block, name);
+        if (!next) {
+            Field *f = find_field_in_block(cur_block, name);
+            if (!f) return NULL;
+            if (f->value.kind == VAL_BLOCK && index < 0) return f->value.blk;
+            if (f->value.kind == VAL_ARRAY && index >= 0) {
+                value_force(&f->value);
+                if ((size_t)index >= f->value.arr_len) return NULL;
+                ValueItem *it = f->value.arr;
+                for (int i = 0; i < index; ++i) it = it->next;
+                return it->v.kind == VAL_BLOCK ? it->v.blk : NULL;
+            }
+        }
+    }
+    if (!next) return NULL;
+
+    /* if an index was provided on an intermediate segment, interpret it as:
+       select the Nth child with that name (0-based). This is a convenience:
+         foo.bar[1].baz
+       will select the second child block named "bar" under foo.
+    */
+    if (index >= 0) {
+        /* walk children and select nth matching name */
+        int seen = 0;
+        Block *sel = NULL;
+        for (Block *c = next->parent ? next->parent->children : top; c; c = c->next) {
+            if (c->name && name && strcmp(c->name, name) == 0) {
+                if (seen == index) { sel = c; break; }
+                seen++;
+            }
+        }
+        next = sel;
+    }
+    return next;
+}
+
+/* Walk `path` starting at the top-level list (start == NULL) or inside
+   `start`. Returns the Value* named by the final segment, or with want_block
+   the Block* it names (a child block or a field holding a block handle).
+   NULL if not found/parse error. */
+static void *lookup_path(Block *top, Block *start, const char *path, int want_block) {
     const char *p = path;
-    Block *cur_block = NULL;
-    Block *top = (Block*)root;
+    Block *cur_block = start;
 
     while (*p) {
         /* find next '.' separating segments (not inside brackets) */
@@ -1398,61 +2104,39 @@ AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
                 }
                 if (!cur_block) { if (label) free(label); return NULL; }
             }
-        } else {
             if (is_final) {
-                /* final segment: must refer to a field name (name != NULL).
-                   If index >=0 then we want an element inside an array field.
-                */
-                if (!name) { if (label) free(label); if (name) free(name); return NULL; }
-                Field *f = find_field_in_block(cur_block, name);
-                if (!f) { free(name); if (label) free(label); return NULL; }
-                free(name); if (label) free(label);
-                if (index < 0) {
-                    return (AclValue*)&f->value;
-                } else {
-                    /* field must be array and index in-bounds; return pointer to element Value */
-                    if (f->value.kind != VAL_ARRAY) return NULL;
-                    if ((size_t)index >= f->value.arr_len) return NULL;
-                    ValueItem *it = f->value.arr;
-                    for (int i = 0; i < index; ++i) it = it->next;
-                    return (AclValue*)&it->v;
-                }
+                if (name) free(name);
+                if (label) free(label);
+                return want_block ? (void*)cur_block : NULL;
+            }
+        } else if (is_final && !want_block) {
+            /* final segment: must refer to a field name (name != NULL).
+               If index >=0 then we want an element inside an array field.
+            */
+            if (!name) { if (label) free(label); if (name) free(name); return NULL; }
+            Field *f = find_field_in_block(cur_block, name);
+            if (!f) { free(name); if (label) free(label); return NULL; }
+            free(name); if (label) free(label);
+            if (index < 0) {
+                return &f->value;
             } else {
-                /* intermediate segment: select child block by name/label, or if name refers to a child array block? */
-                Block *next = NULL;
-                if (label && name) {
-                    next = find_child_by_name_and_label(cur_block, name, label);
-                } else if (label && !name) {
-                    /* choose first child whose label matches */
-                    for (Block *c = cur_block->children; c; c = c->next) {
-                        if (c->label && strcmp(c->label, label) == 0) { next = c; break; }
-                    }
-                } else if (name && !label) {
-                    /* first child with that name */
-                    next = find_child_by_name(cur_block, name);
-                }
-                if (!next) { free(name); if (label) free(label); return NULL; }
-                cur_block = next;
-
-                /* if an index was provided on an intermediate segment, interpret it as:
-                   select the Nth child with that name (0-based). This is a convenience:
-                     foo.bar[1].baz
-                   will select the second child block named "bar" under foo.
-                */
-                if (index >= 0) {
-                    /* walk children and select nth matching name */
-                    int seen = 0;
-                    Block *sel = NULL;
-                    for (Block *c = cur_block->parent ? cur_block->parent->children : top; c; c = c->next) {
-                        if (c->name && name && strcmp(c->name, name) == 0) {
-                            if (seen == index) { sel = c; break; }
-                            seen++;
-                        }
-                    }
-                    if (!sel) { if (name) free(name); if (label) free(label); return NULL; }
-                    cur_block = sel;
-                }
+                /* field must be array and index in-bounds; return pointer to element Value */
+                if (f->value.kind != VAL_ARRAY) return NULL;
+                value_force(&f->value);
+                if ((size_t)index >= f->value.arr_len) return NULL;
+                ValueItem *it = f->value.arr;
+                for (int i = 0; i < index; ++i) it = it->next;
+                return &it->v;
             }
+        } else {
+            Block *next = path_step(top, cur_block, name, label, index);
+            if (name) free(name);
+            if (label) free(label);
+            if (!next) return NULL;
+            if (is_final) return next;
+            cur_block = next;
+            p = q + 1;
+            continue;
         }
 
         if (name) free(name);
@@ -1464,6 +2148,48 @@ AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
     return NULL;
 }
 
+/* Find a Value* given a path with optional numeric indexing.
+   Returns pointer to Value inside tree (do not free) or NULL if not found/parse error.
+*/
+AclValue *acl_find_value_by_path(AclBlock *root, const char *path) {
+    if (!root || !path) return NULL;
+    return (AclValue*)lookup_path((Block*)root, NULL, path, 0);
+}
+
+AclBlock *acl_get_block(AclBlock *root, const char *path) {
+    if (!root || !path) return NULL;
+    return (AclBlock*)lookup_path((Block*)root, NULL, path, 1);
+}
+
+AclValue *acl_block_find_value(AclBlock *block, const char *path) {
+    if (!block || !path) return NULL;
+    return (AclValue*)lookup_path(NULL, (Block*)block, path, 0);
+}
+
+AclBlock *acl_block_get_block(AclBlock *block, const char *path) {
+    if (!block || !path) return NULL;
+    return (AclBlock*)lookup_path(NULL, (Block*)block, path, 1);
+}
+
+size_t acl_array_length(AclValue *array) {
+    Value *v = (Value*)array;
+    if (!v || v->kind != VAL_ARRAY) return 0;
+    value_force(v);
+    return v->arr_len;
+}
+
+AclValue *acl_array_next(AclValue *array, AclValue *prev) {
+    Value *v = (Value*)array;
+    if (!v || v->kind != VAL_ARRAY) return NULL;
+    if (!prev) {
+        value_force(v);
+        return v->arr ? (AclValue*)&v->arr->v : NULL;
+    }
+    /* elements live at the start of their ValueItem */
+    ValueItem *it = ((ValueItem*)prev)->next;
+    return it ? (AclValue*)&it->v : NULL;
+}
+
 /* Updated typed getters that use the above function.
    These return 1 on success, 0 otherwise.
 */
@@ -1507,3 +2233,950 @@ int acl_get_string(AclBlock *root, const char *path, char **out) {
     }
     return 0;
 }
+
+/* ---------------------------
+   Schema validation
+   ---------------------------
+   A schema is itself an ACL file that mirrors the shape of the configs it
+   checks:
+
+     Users {
+         user {
+             bool unique_labels = true;
+             field "uid"   { string type = "int"; bool required = true; int min = 0; int max = 65535; }
+             field "shell" { string type = "string"; default = "/bin/sh"; }
+         }
+     }
+
+   Schema blocks describe config blocks of the same name (options:
+   `bool required`, `bool unique_labels`), except `field "name"` blocks, which
+   describe fields (options: `string type`, `bool required`, `min`, `max`,
+   `one_of = { ... }`, `default`). Anything the schema does not mention is
+   left alone.
+
+   Compilation interns every name and builds a hashed name index per schema
+   node, so validation is a single walk over the config tree.
+*/
+
+typedef struct { unsigned hash; const char *name; int idx; } NameSlot;
+typedef struct { NameSlot *slots; unsigned mask; } NameIndex;
+
+typedef struct SchemaField {
+    const char *name;        /* interned */
+    const char *type_name;   /* interned, NULL if the schema gives no type */
+    ValKind kind;
+    int required;
+    int has_min, has_max;
+    double min, max;
+    const Value *one_of;     /* VAL_ARRAY inside the schema tree, or NULL */
+    const Value *def;        /* default inside the schema tree, or NULL */
+} SchemaField;
+
+typedef struct SchemaNode {
+    const char *name;        /* interned */
+    int required;
+    int unique_labels;
+    SchemaField *fields;
+    size_t n_fields;
+    struct SchemaNode *children;
+    size_t n_children;
+    NameIndex field_index;
+    NameIndex child_index;
+} SchemaNode;
+
+struct AclSchema {
+    Block *tree;             /* owned when loaded from a file */
+    SchemaNode root;         /* virtual node whose children are the top-level blocks */
+    NameIndex atoms;
+    size_t n_atoms;
+};
+
+static int name_index_init(NameIndex *ix, size_t n) {
+    unsigned cap = 4;
+    while (cap < n * 2) cap <<= 1;
+    ix->slots = calloc(cap, sizeof(NameSlot));
+    ix->mask = cap - 1;
+    return ix->slots != NULL;
+}
+
+/* returns the slot holding `name`, or the empty slot where it would go */
+static NameSlot *name_index_probe(const NameIndex *ix, const char *name, unsigned h) {
+    unsigned i = h & ix->mask;
+    for (;;) {
+        NameSlot *s = &ix->slots[i];
+        if (!s->name) return s;
+        if (s->hash == h && (s->name == name || strcmp(s->name, name) == 0)) return s;
+        i = (i + 1) & ix->mask;
+    }
+}
+
+static int name_index_find(const NameIndex *ix, const char *name) {
+    if (!ix->slots || !name) return -1;
+    NameSlot *s = name_index_probe(ix, name, name_hash(name));
+    return s->name ? s->idx : -1;
+}
+
+static const char *schema_intern(AclSchema *S, const char *name) {
+    unsigned h = name_hash(name);
+    NameSlot *s = name_index_probe(&S->atoms, name, h);
+    if (s->name) return s->name;
+    if ((S->n_atoms + 1) * 2 > S->atoms.mask + 1) {
+        NameIndex grown;
+        if (!name_index_init(&grown, S->n_atoms + 1)) return NULL;
+        for (unsigned i = 0; i <= S->atoms.mask; ++i) {
+            NameSlot *o = &S->atoms.slots[i];
+            if (o->name) *name_index_probe(&grown, o->name, o->hash) = *o;
+        }
+        free(S->atoms.slots);
+        S->atoms = grown;
+        s = name_index_probe(&S->atoms, name, h);
+    }
+    s->name = str_dup_local(name);
+    s->hash = h;
+    s->idx = (int)S->n_atoms++;
+    return s->name;
+}
+
+static const char *valkind_name(ValKind k) {
+    switch (k) {
+        case VAL_INT: return "int";
+        case VAL_FLOAT: return "float";
+        case VAL_BOOL: return "bool";
+        case VAL_STRING: return "string";
+        case VAL_CHAR: return "char";
+        case VAL_ARRAY: return "array";
+        case VAL_REF: return "unresolved reference";
+        case VAL_BLOCK: return "block reference";
+        case VAL_CALL: return "unevaluated call";
+    }
+    return "?";
+}
+
+static int schema_kind_from_name(const char *s, ValKind *out) {
+    static const struct { const char *name; ValKind kind; } kinds[] = {
+        { "int", VAL_INT }, { "float", VAL_FLOAT }, { "bool", VAL_BOOL },
+        { "string", VAL_STRING }, { "char", VAL_CHAR }, { "array", VAL_ARRAY },
+        { "ref", VAL_REF },  /* a declared `ref` field, whatever it resolved to */
+    };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); ++i) {
+        if (strcmp(s, kinds[i].name) == 0) { *out = kinds[i].kind; return 1; }
+    }
+    return 0;
+}
+
+static int schema_number(const Value *v, double *out) {
+    if (v->kind == VAL_INT) { *out = (double)v->ival; return 1; }
+    if (v->kind == VAL_FLOAT) { *out = v->fval; return 1; }
+    return 0;
+}
+
+static int value_in_array(const Value *v, const Value *set) {
+    value_force((Value*)set);
+    for (const ValueItem *it = set->arr; it; it = it->next) {
+        const Value *w = &it->v;
+        if (w->kind != v->kind) continue;
+        switch (v->kind) {
+            case VAL_INT: if (w->ival == v->ival) return 1; break;
+            case VAL_FLOAT: if (w->fval == v->fval) return 1; break;
+            case VAL_BOOL: if (w->bval == v->bval) return 1; break;
+            case VAL_CHAR: if (w->cval == v->cval) return 1; break;
+            case VAL_STRING: if (w->sval && v->sval && strcmp(w->sval, v->sval) == 0) return 1; break;
+            case VAL_BLOCK: if (w->blk == v->blk) return 1; break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+/* the field's type accepts v (ints widen to float). `ref` is checked against
+   the declared type, as a resolved ref holds its target's kind; decl is NULL
+   for a default, which has none */
+static int schema_kind_ok(const SchemaField *sf, const char *decl, const Value *v) {
+    if (!sf->type_name) return 1;
+    if (sf->kind == VAL_REF) return v->kind != VAL_REF && (!decl || strcmp(decl, "ref") == 0);
+    return v->kind == sf->kind || (sf->kind == VAL_FLOAT && v->kind == VAL_INT);
+}
+
+/* validation appends defaults as-is, so a default must pass the field's own
+   type, range and one_of checks; returns what is wrong with it, or NULL */
+static const char *schema_default_error(const SchemaField *sf) {
+    const Value *v = sf->def;
+    if (!schema_kind_ok(sf, NULL, v)) return "does not match the field's type";
+    double x;
+    if ((sf->has_min || sf->has_max) && schema_number(v, &x)
+        && ((sf->has_min && x < sf->min) || (sf->has_max && x > sf->max))) return "is outside [min, max]";
+    if (sf->one_of && !value_in_array(v, sf->one_of)) return "is not one of one_of";
+    return NULL;
+}
+
+static int schema_compile_field(AclSchema *S, SchemaField *sf, const Block *fb) {
+    memset(sf, 0, sizeof(*sf));
+    sf->name = schema_intern(S, fb->label);
+    if (!sf->name) return 0;
+    for (const Field *o = fb->fields; o; o = o->next) {
+        const Value *v = &o->value;
+        if (strcmp(o->name, "type") == 0 && v->kind == VAL_STRING && v->sval) {
+            if (!schema_kind_from_name(v->sval, &sf->kind)) {
+                fprintf(stderr, "Schema error: field \"%s\": unknown type \"%s\"\n", fb->label, v->sval);
+                return 0;
+            }
+            sf->type_name = schema_intern(S, v->sval);
+        } else if (strcmp(o->name, "required") == 0 && v->kind == VAL_BOOL) {
+            sf->required = v->bval;
+        } else if (strcmp(o->name, "min") == 0 && schema_number(v, &sf->min)) {
+            sf->has_min = 1;
+        } else if (strcmp(o->name, "max") == 0 && schema_number(v, &sf->max)) {
+            sf->has_max = 1;
+        } else if (strcmp(o->name, "one_of") == 0 && v->kind == VAL_ARRAY) {
+            sf->one_of = v;
+        } else if (strcmp(o->name, "default") == 0 && v->kind != VAL_REF) {
+            sf->def = v;
+        } else {
+            fprintf(stderr, "Schema error: field \"%s\": invalid option '%s'\n", fb->label, o->name);
+            return 0;
+        }
+    }
+    const char *bad = sf->def ? schema_default_error(sf) : NULL;
+    if (bad) {
+        fprintf(stderr, "Schema error: field \"%s\": default %s\n", fb->label, bad);
+        return 0;
+    }
+    return 1;
+}
+
+static int schema_compile_node(AclSchema *S, SchemaNode *node, const Block *first_child, const Field *options) {
+    for (const Field *o = options; o; o = o->next) {
+        if (strcmp(o->name, "required") == 0 && o->value.kind == VAL_BOOL) node->required = o->value.bval;
+        else if (strcmp(o->name, "unique_labels") == 0 && o->value.kind == VAL_BOOL) node->unique_labels = o->value.bval;
+        else {
+            fprintf(stderr, "Schema error: block '%s': invalid option '%s'\n", node->name ? node->name : "", o->name);
+            return 0;
+        }
+    }
+
+    for (const Block *c = first_child; c; c = c->next) {
+        if (strcmp(c->name, "field") == 0) {
+            if (!c->label) { fprintf(stderr, "Schema error: 'field' block needs a label\n"); return 0; }
+            node->n_fields++;
+        } else {
+            node->n_children++;
+        }
+    }
+    node->fields = calloc(node->n_fields ? node->n_fields : 1, sizeof(SchemaField));
+    node->children = calloc(node->n_children ? node->n_children : 1, sizeof(SchemaNode));
+    if (!node->fields || !node->children) return 0;
+    if (!name_index_init(&node->field_index, node->n_fields)) return 0;
+    if (!name_index_init(&node->child_index, node->n_children)) return 0;
+
+    size_t nf = 0, nc = 0;
+    for (const Block *c = first_child; c; c = c->next) {
+        if (strcmp(c->name, "field") == 0) {
+            SchemaField *sf = &node->fields[nf];
+            if (!schema_compile_field(S, sf, c)) return 0;
+            NameSlot *s = name_index_probe(&node->field_index, sf->name, name_hash(sf->name));
+            if (s->name) { fprintf(stderr, "Schema error: field \"%s\" declared twice\n", sf->name); return 0; }
+            s->name = sf->name; s->hash = name_hash(sf->name); s->idx = (int)nf++;
+        } else {
+            SchemaNode *child = &node->children[nc];
+            child->name = schema_intern(S, c->name);
+            if (!child->name) return 0;
+            NameSlot *s = name_index_probe(&node->child_index, child->name, name_hash(child->name));
+            if (s->name) { fprintf(stderr, "Schema error: block '%s' declared twice\n", child->name); return 0; }
+            s->name = child->name; s->hash = name_hash(child->name); s->idx = (int)nc++;
+            if (!schema_compile_node(S, child, c->children, c->fields)) return 0;
+        }
+    }
+    return 1;
+}
+
+static void schema_node_free(SchemaNode *node) {
+    for (size_t i = 0; i < node->n_children; ++i) schema_node_free(&node->children[i]);
+    free(node->children);
+    free(node->fields);
+    free(node->field_index.slots);
+    free(node->child_index.slots);
+}
+
+void acl_schema_free(AclSchema *schema) {
+    if (!schema) return;
+    schema_node_free(&schema->root);
+    if (schema->atoms.slots) {
+        for (unsigned i = 0; i <= schema->atoms.mask; ++i) free((char*)schema->atoms.slots[i].name);
+        free(schema->atoms.slots);
+    }
+    if (schema->tree) free_blocks(schema->tree);
+    free(schema);
+}
+
+AclSchema *acl_schema_compile(AclBlock *schema_root) {
+    if (!schema_root) return NULL;
+    AclSchema *S = calloc(1, sizeof(*S));
+    if (!S) return NULL;
+    if (!name_index_init(&S->atoms, 32) || !schema_compile_node(S, &S->root, (Block*)schema_root, NULL)) {
+        acl_schema_free(S);
+        return NULL;
+    }
+    return S;
+}
+
+AclSchema *acl_schema_load(const char *path) {
+    AclBlock *tree = acl_parse_file(path);
+    if (!tree) return NULL;
+    acl_resolve_all(tree);
+    AclSchema *S = acl_schema_compile(tree);
+    if (!S) { acl_free(tree); return NULL; }
+    S->tree = (Block*)tree;
+    return S;
+}
+
+/* validation state: collected violations and the path of the block being visited */
+typedef struct {
+    AclError *errs;
+    size_t n_errs, cap_errs;
+    char *path;
+    size_t path_len, path_cap;
+} SchemaCtx;
+
+static void schema_path_push(SchemaCtx *C, const char *name, const char *label) {
+    size_t need = C->path_len + strlen(name) + (label ? strlen(label) + 4 : 0) + 2;
+    if (need > C->path_cap) {
+        while (need > C->path_cap) C->path_cap = C->path_cap ? C->path_cap * 2 : 128;
+        C->path = realloc(C->path, C->path_cap);
+    }
+    char *p = C->path + C->path_len;
+    if (C->path_len) *p++ = '.';
+    size_t n = strlen(name);
+    memcpy(p, name, n); p += n;
+    if (label) {
+        *p++ = '['; *p++ = '"';
+        n = strlen(label);
+        memcpy(p, label, n); p += n;
+        *p++ = '"'; *p++ = ']';
+    }
+    *p = '\0';
+    C->path_len = (size_t)(p - C->path);
+}
+
+static void schema_violation(SchemaCtx *C, int code, const char *field, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void schema_violation(SchemaCtx *C, int code, const char *field, const char *fmt, ...) {
+    if (C->n_errs == C->cap_errs) {
+        size_t cap = C->cap_errs ? C->cap_errs * 2 : 16;
+        AclError *grown = realloc(C->errs, cap * sizeof(AclError));
+        if (!grown) return;
+        C->errs = grown;
+        C->cap_errs = cap;
+    }
+    char detail[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(detail, sizeof(detail), fmt, ap);
+    va_end(ap);
+
+    const char *path = C->path_len ? C->path : "";
+    size_t len = strlen(path) + (field ? strlen(field) + 1 : 0) + strlen(detail) + 3;
+    char *msg = malloc(len);
+    if (msg) snprintf(msg, len, "%s%s%s: %s", path, (field && C->path_len) ? "." : "", field ? field : "", detail);
+
+    AclError *e = &C->errs[C->n_errs++];
+    memset(e, 0, sizeof(*e));
+    e->code = code;
+    e->message = msg;
+}
+
+static void schema_check_field(SchemaCtx *C, const SchemaField *sf, const Field *f) {
+    const Value *v = &f->value;
+    if (!schema_kind_ok(sf, f->type, v)) {
+        schema_violation(C, ACL_SCHEMA_TYPE, f->name, "expected %s, got %s", sf->type_name,
+                         sf->kind == VAL_REF && v->kind != VAL_REF && f->type ? f->type : valkind_name(v->kind));
+        return;
+    }
+    double x;
+    if ((sf->has_min || sf->has_max) && schema_number(v, &x)) {
+        if ((sf->has_min && x < sf->min) || (sf->has_max && x > sf->max)) {
+            schema_violation(C, ACL_SCHEMA_RANGE, f->name, "value %g outside [%g, %g]", x,
+                             sf->has_min ? sf->min : -HUGE_VAL, sf->has_max ? sf->max : HUGE_VAL);
+        }
+    }
+    if (sf->one_of && !value_in_array(v, sf->one_of)) {
+        schema_violation(C, ACL_SCHEMA_ENUM, f->name, "value not one of the allowed values");
+    }
+}
+
+static void schema_validate_children(SchemaCtx *C, const SchemaNode *node, Block *first);
+
+static void schema_validate_block(SchemaCtx *C, const SchemaNode *node, Block *blk) {
+    size_t saved_len = C->path_len;
+    schema_path_push(C, blk->name, blk->label);
+
+    /* bitmap of schema fields present in this block */
+    const size_t bits = sizeof(unsigned long) * 8;
+    unsigned long small = 0, *seen = &small;
+    if (node->n_fields > bits) seen = calloc((node->n_fields + bits - 1) / bits, sizeof(unsigned long));
+    if (!seen) {
+        schema_violation(C, ACL_SCHEMA_NO_MEMORY, NULL, "out of memory, block not checked");
+        C->path_len = saved_len;
+        if (C->path) C->path[saved_len] = '\0';
+        return;
+    }
+
+    Field *last = NULL;
+    int added = 0;
+    for (Field *f = blk->fields; f; f = f->next) {
+        last = f;
+        int i = name_index_find(&node->field_index, f->name);
+        if (i < 0) continue;
+        if (seen[i / bits] & (1UL << (i % bits))) continue; /* lookups favor the first */
+        seen[i / bits] |= 1UL << (i % bits);
+        schema_check_field(C, &node->fields[i], f);
+    }
+
+    for (size_t i = 0; i < node->n_fields; ++i) {
+        if (seen[i / bits] & (1UL << (i % bits))) continue;
+        const SchemaField *sf = &node->fields[i];
+        if (sf->def) {
+            Field *nf = malloc(sizeof(Field)); memset(nf, 0, sizeof(Field));
+            nf->type = sf->type_name ? str_dup_local(sf->type_name) : NULL;
+            nf->name = str_dup_local(sf->name);
+            nf->value = value_deep_copy(sf->def);
+            if (last) last->next = nf; else blk->fields = nf;
+            last = nf;
+            added = 1;
+        } else if (sf->required) {
+            schema_violation(C, ACL_SCHEMA_MISSING_FIELD, sf->name, "missing required field");
+        }
+    }
+    if (added) block_index_fields(blk);
+    if (seen != &small) free(seen);
+
+    schema_validate_children(C, node, blk->children);
+    C->path_len = saved_len;
+    if (C->path) C->path[saved_len] = '\0';
+}
+
+static void schema_validate_children(SchemaCtx *C, const SchemaNode *node, Block *first) {
+    if (node->n_children == 0) return;
+
+    const size_t bits = sizeof(unsigned long) * 8;
+    unsigned long small = 0, *seen = &small;
+    if (node->n_children > bits) seen = calloc((node->n_children + bits - 1) / bits, sizeof(unsigned long));
+    if (!seen) {
+        schema_violation(C, ACL_SCHEMA_NO_MEMORY, NULL, "out of memory, blocks not checked");
+        return;
+    }
+    NameIndex labels = { NULL, 0 };   /* (child kind, label) pairs seen so far */
+
+    for (Block *c = first; c; c = c->next) {
+        int i = name_index_find(&node->child_index, c->name);
+        if (i < 0) continue;
+        const SchemaNode *sn = &node->children[i];
+        seen[i / bits] |= 1UL << (i % bits);
+
+        if (sn->unique_labels && c->label) {
+            if (!labels.slots) {
+                size_t n = 0;
+                for (Block *d = c; d; d = d->next) n++;
+                name_index_init(&labels, n);
+            }
+            if (labels.slots) {
+                unsigned h = name_hash(c->label) ^ (unsigned)i * 2654435761u;
+                unsigned k = h & labels.mask;
+                int dup = 0;
+                while (labels.slots[k].name) {
+                    NameSlot *s = &labels.slots[k];
+                    if (s->hash == h && s->idx == i && strcmp(s->name, c->label) == 0) { dup = 1; break; }
+                    k = (k + 1) & labels.mask;
+                }
+                if (dup) {
+                    schema_violation(C, ACL_SCHEMA_DUPLICATE_LABEL, c->name, "duplicate label \"%s\"", c->label);
+                } else {
+                    labels.slots[k].name = c->label; labels.slots[k].hash = h; labels.slots[k].idx = i;
+                }
+            }
+        }
+        schema_validate_block(C, sn, c);
+    }
+
+    for (size_t i = 0; i < node->n_children; ++i) {
+        if (node->children[i].required && !(seen[i / bits] & (1UL << (i % bits))))
+            schema_violation(C, ACL_SCHEMA_MISSING_BLOCK, node->children[i].name, "missing required block");
+    }
+    free(labels.slots);
+    if (seen != &small) free(seen);
+}
+
+size_t acl_schema_validate(const AclSchema *schema, AclBlock *root, AclError **errors) {
+    if (errors) *errors = NULL;
+    if (!schema) return 0;
+    SchemaCtx C;
+    memset(&C, 0, sizeof(C));
+    schema_validate_children(&C, &schema->root, (Block*)root);
+    free(C.path);
+    if (errors) *errors = C.errs;
+    else acl_schema_errors_free(C.errs, C.n_errs);
+    return C.n_errs;
+}
+
+void acl_schema_errors_free(AclError *errors, size_t n) {
+    if (!errors) return;
+    for (size_t i = 0; i < n; ++i) free(errors[i].message);
+    free(errors);
+}
+
+/* ---------------------------
+   Spawn helpers: envp / argv from a block
+   ---------------------------
+   Both builders walk the block's fields once to size the result, then once
+   more to write it, and return a single allocation holding the pointer
+   vector followed by the strings. Numbers and bools are formatted by hand;
+   only floats go through snprintf.
+*/
+
+struct AclArenaChunk {
+    struct AclArenaChunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+static void *arena_alloc(AclArena *arena, size_t n) {
+    n = (n + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    struct AclArenaChunk *c = arena->head;
+    if (!c || c->size - c->used < n) {
+        size_t size = c ? c->size * 2 : 4096;
+        while (size < n) size *= 2;
+        c = malloc(sizeof(*c) + size);
+        if (!c) return NULL;
+        c->next = arena->head;
+        c->size = size;
+        c->used = 0;
+        arena->head = c;
+    }
+    void *p = (char*)c->data + c->used;
+    c->used += n;
+    return p;
+}
+
+void acl_arena_reset(AclArena *arena) {
+    if (!arena || !arena->head) return;
+    /* keep the newest (largest) chunk for reuse */
+    struct AclArenaChunk *c = arena->head->next;
+    while (c) { struct AclArenaChunk *n = c->next; free(c); c = n; }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+void acl_arena_free(AclArena *arena) {
+    if (!arena) return;
+    struct AclArenaChunk *c = arena->head;
+    while (c) { struct AclArenaChunk *n = c->next; free(c); c = n; }
+    arena->head = NULL;
+}
+
+static size_t fmt_long_len(long x) {
+    unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+    size_t n = x < 0 ? 2 : 1;
+    while (u >= 10) { u /= 10; n++; }
+    return n;
+}
+
+static char *fmt_long(char *dst, long x) {
+    unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+    char tmp[24];
+    size_t n = 0;
+    do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (x < 0) *dst++ = '-';
+    while (n) *dst++ = tmp[--n];
+    return dst;
+}
+
+static int spawn_scalar(const Value *v) {
+    return v->kind == VAL_INT || v->kind == VAL_FLOAT || v->kind == VAL_BOOL
+        || v->kind == VAL_STRING || v->kind == VAL_CHAR;
+}
+
+/* length of a scalar as text; dst == NULL only measures, else writes and
+   returns the end pointer through *end */
+static size_t spawn_format(const Value *v, int flags, char *dst, char **end) {
+    char fbuf[32];
+    const char *s = NULL;
+    size_t n = 0;
+    switch (v->kind) {
+        case VAL_INT:
+            n = fmt_long_len(v->ival);
+            if (dst) *end = fmt_long(dst, v->ival);
+            return n;
+        case VAL_FLOAT:
+            n = (size_t)snprintf(fbuf, sizeof(fbuf), "%g", v->fval);
+            s = fbuf;
+            break;
+        case VAL_BOOL:
+            s = (flags & ACL_ENV_BOOL_WORDS) ? (v->bval ? "true" : "false") : (v->bval ? "1" : "0");
+            n = strlen(s);
+            break;
+        case VAL_STRING:
+            s = v->sval ? v->sval : "";
+            n = strlen(s);
+            break;
+        case VAL_CHAR:
+            fbuf[0] = (char)v->cval;
+            s = fbuf; n = 1;
+            break;
+        default:
+            return 0;
+    }
+    if (dst) { memcpy(dst, s, n); *end = dst + n; }
+    return n;
+}
+
+/* values that have a text form: scalars and non-empty arrays of scalars.
+   An array holding anything else (block handles of a `ref[]`, nested
+   arrays) has none rather than losing those elements silently. */
+static int spawn_has_text(Value *v) {
+    if (spawn_scalar(v)) return 1;
+    if (v->kind != VAL_ARRAY) return 0;
+    value_force(v);
+    if (!v->arr) return 0;
+    for (const ValueItem *it = v->arr; it; it = it->next)
+        if (!spawn_scalar(&it->v)) return 0;
+    return 1;
+}
+
+/* text of a field value: scalars as above, arrays of scalars joined with ','
+   (':' with ACL_ENV_ARRAY_COLON). Returns 0 for values without a text form
+   (see spawn_has_text). */
+static int spawn_value_text(Value *v, int flags, char *dst, char **end, size_t *len) {
+    if (spawn_scalar(v)) { *len = spawn_format(v, flags, dst, end); return 1; }
+    if (!spawn_has_text(v)) return 0;
+    char sep = (flags & ACL_ENV_ARRAY_COLON) ? ':' : ',';
+    size_t n = 0;
+    for (ValueItem *it = v->arr; it; it = it->next) {
+        if (it != v->arr) { n++; if (dst) *dst++ = sep; }
+        n += spawn_format(&it->v, flags, dst, &dst);
+    }
+    if (dst) *end = dst;
+    *len = n;
+    return 1;
+}
+
+static void *spawn_alloc(AclArena *arena, size_t n) {
+    return arena ? arena_alloc(arena, n) : malloc(n);
+}
+
+char **acl_block_to_envp(AclBlock *block, const char *prefix, int flags, AclArena *arena) {
+    Block *blk = (Block*)block;
+    if (!blk) return NULL;
+    size_t plen = prefix ? strlen(prefix) : 0;
+
+    /* pass 1: count entries and bytes */
+    size_t count = 0, bytes = 0;
+    for (Field *f = blk->fields; f; f = f->next) {
+        size_t vlen;
+        if (!spawn_value_text(&f->value, flags, NULL, NULL, &vlen)) continue;
+        count++;
+        bytes += plen + strlen(f->name) + 1 + vlen + 1;
+    }
+
+    size_t vec = (count + 1) * sizeof(char*);
+    char **envp = spawn_alloc(arena, vec + bytes);
+    if (!envp) return NULL;
+
+    /* pass 2: write "PREFIXNAME=value" strings after the vector */
+    char *p = (char*)envp + vec;
+    size_t i = 0;
+    for (Field *f = blk->fields; f; f = f->next) {
+        size_t vlen;
+        if (!spawn_has_text(&f->value)) continue;
+        envp[i++] = p;
+        if (plen) { memcpy(p, prefix, plen); p += plen; }
+        for (const char *n = f->name; *n; ++n)
+            *p++ = (flags & ACL_ENV_UPPERCASE) ? (char)toupper((unsigned char)*n) : *n;
+        *p++ = '=';
+        spawn_value_text(&f->value, flags, p, &p, &vlen);
+        *p++ = '\0';
+    }
+    envp[i] = NULL;
+    return envp;
+}
+
+char **acl_block_to_argv(AclBlock *block, const char *exec_field, const char *args_field, AclArena *arena) {
+    Block *blk = (Block*)block;
+    if (!blk || !exec_field) return NULL;
+
+    /* one walk to find both fields (first match wins, as in lookups) */
+    Value *exec = NULL, *args = NULL;
+    for (Field *f = blk->fields; f && !(exec && (args || !args_field)); f = f->next) {
+        if (!exec && strcmp(f->name, exec_field) == 0) exec = &f->value;
+        else if (args_field && !args && strcmp(f->name, args_field) == 0) args = &f->value;
+    }
+    if (!exec || !spawn_scalar(exec)) return NULL;
+    if (args) {
+        if (args->kind != VAL_ARRAY && !spawn_scalar(args)) args = NULL;
+        else value_force(args);
+    }
+
+    size_t count = 1, bytes = spawn_format(exec, 0, NULL, NULL) + 1;
+    if (args && args->kind == VAL_ARRAY) {
+        for (ValueItem *it = args->arr; it; it = it->next) {
+            if (!spawn_scalar(&it->v)) continue;
+            count++;
+            bytes += spawn_format(&it->v, 0, NULL, NULL) + 1;
+        }
+    } else if (args) {
+        count++;
+        bytes += spawn_format(args, 0, NULL, NULL) + 1;
+    }
+
+    size_t vec = (count + 1) * sizeof(char*);
+    char **argv = spawn_alloc(arena, vec + bytes);
+    if (!argv) return NULL;
+
+    char *p = (char*)argv + vec;
+    size_t i = 0;
+    argv[i++] = p; spawn_format(exec, 0, p, &p); *p++ = '\0';
+    if (args && args->kind == VAL_ARRAY) {
+        for (ValueItem *it = args->arr; it; it = it->next) {
+            if (!spawn_scalar(&it->v)) continue;
+            argv[i++] = p; spawn_format(&it->v, 0, p, &p); *p++ = '\0';
+        }
+    } else if (args) {
+        argv[i++] = p; spawn_format(args, 0, p, &p); *p++ = '\0';
+    }
+    argv[i] = NULL;
+    return argv;
+}
+
+/* -----------------------------
+   Builtin functions
+   ----------------------------- */
+
+/* Builtins are evaluated while the config loads, never at lookup time: a call
+   whose arguments are all literals is folded by the parser, one that takes
+   references is evaluated by acl_resolve_all once they resolve. Both run
+   under PARSE_LOCK, so lazy arrays are decoded with array_decode directly. */
+
+typedef Value (*BuiltinFn)(const Call *c);
+typedef struct { const char *name; BuiltinFn fn; int min_args; int max_args; /* -1: any */ } Builtin;
+
+static const Builtin BUILTINS[];
+
+static void builtin_error(const Call *c, const char *msg) {
+    fprintf(stderr, "Builtin error at %d:%d: %s() %s\n", c->line, c->col, BUILTINS[c->fn].name, msg);
+    show_line_context(c->pos, c->line, c->col);
+    exit(1);
+}
+
+static Value *builtin_arg(const Call *c, size_t i) {
+    Value *v = &c->args[i];
+    if (v->kind == VAL_ARRAY && v->lazy_src) array_decode(v);
+    return v;
+}
+
+/* text of a scalar or array-of-scalars argument (an empty array is "");
+   measures when dst is NULL */
+static size_t builtin_text(const Call *c, Value *v, char *dst, char **end) {
+    size_t n;
+    if (v->kind == VAL_ARRAY && !v->arr) { if (dst) *end = dst; return 0; }
+    if (!spawn_value_text(v, ACL_ENV_BOOL_WORDS, dst, end, &n)) builtin_error(c, "argument has no text form");
+    return n;
+}
+
+/* no references left to resolve (a block handle is resolved: the builtin
+   itself rejects it as an argument of the wrong kind) */
+static int value_is_constant(const Value *v) {
+    if (v->kind == VAL_REF) return 0;
+    if (v->kind == VAL_CALL) {
+        for (size_t i = 0; i < v->call->nargs; ++i)
+            if (!value_is_constant(&v->call->args[i])) return 0;
+        return 1;
+    }
+    /* lazy array text never holds references, see scan_array_span */
+    if (v->kind == VAL_ARRAY)
+        for (const ValueItem *it = v->arr; it; it = it->next)
+            if (!value_is_constant(&it->v)) return 0;
+    return 1;
+}
+
+static Value builtin_len(const Call *c) {
+    Value *v = builtin_arg(c, 0);
+    if (v->kind == VAL_ARRAY) return make_int((long)v->arr_len);
+    if (v->kind == VAL_STRING) return make_int(v->sval ? (long)strlen(v->sval) : 0);
+    builtin_error(c, "expects an array or a string");
+    return make_int(0);
+}
+
+static Value builtin_join(const Call *c) {
+    Value *arr = builtin_arg(c, 0), *sep = builtin_arg(c, 1);
+    if (arr->kind != VAL_ARRAY) builtin_error(c, "expects an array as its first argument");
+    if (sep->kind != VAL_STRING && sep->kind != VAL_CHAR) builtin_error(c, "expects a string separator");
+
+    size_t slen = builtin_text(c, sep, NULL, NULL), n = 0;
+    for (ValueItem *it = arr->arr; it; it = it->next) {
+        if (!spawn_scalar(&it->v)) builtin_error(c, "expects an array of scalars");
+        n += (it == arr->arr ? 0 : slen) + spawn_format(&it->v, ACL_ENV_BOOL_WORDS, NULL, NULL);
+    }
+    char *out = malloc(n + 1), *p = out;
+    for (ValueItem *it = arr->arr; it; it = it->next) {
+        if (it != arr->arr) builtin_text(c, sep, p, &p);
+        spawn_format(&it->v, ACL_ENV_BOOL_WORDS, p, &p);
+    }
+    *p = '\0';
+    return make_string_owned(out);
+}
+
+/* min/max over one array argument or over the arguments themselves;
+   the result is an int when every input is an int */
+static Value builtin_extreme(const Call *c, int want_max) {
+    const Value *first = builtin_arg(c, 0);
+    const ValueItem *it = NULL;
+    if (c->nargs == 1 && first->kind == VAL_ARRAY) {
+        it = first->arr;
+        if (!it) builtin_error(c, "of an empty array");
+    }
+
+    int all_int = 1, have = 0;
+    long ibest = 0;
+    double fbest = 0;
+    for (size_t i = 0; it || i < c->nargs; ++i) {
+        const Value *v = it ? &it->v : &c->args[i];
+        if (v->kind != VAL_INT && v->kind != VAL_FLOAT) builtin_error(c, "expects numbers");
+        double d = v->kind == VAL_INT ? (double)v->ival : v->fval;
+        if (v->kind == VAL_INT && all_int) {
+            if (!have || (want_max ? v->ival > ibest : v->ival < ibest)) ibest = v->ival;
+        }
+        if (v->kind == VAL_FLOAT) all_int = 0;
+        if (!have || (want_max ? d > fbest : d < fbest)) fbest = d;
+        have = 1;
+        if (it && !(it = it->next)) break;
+    }
+    return all_int ? make_int(ibest) : make_float(fbest);
+}
+
+static Value builtin_min(const Call *c) { return builtin_extreme(c, 0); }
+static Value builtin_max(const Call *c) { return builtin_extreme(c, 1); }
+
+static Value builtin_contains(const Call *c) {
+    Value *hay = builtin_arg(c, 0), *needle = builtin_arg(c, 1);
+    if (hay->kind == VAL_ARRAY) return make_bool(value_in_array(needle, hay));
+    if (hay->kind == VAL_STRING) {
+        const char *s = hay->sval ? hay->sval : "";
+        if (needle->kind == VAL_CHAR) return make_bool(strchr(s, needle->cval) != NULL);
+        if (needle->kind == VAL_STRING) return make_bool(strstr(s, needle->sval ? needle->sval : "") != NULL);
+        builtin_error(c, "expects a string or char to look for in a string");
+    }
+    builtin_error(c, "expects an array or a string");
+    return make_bool(0);
+}
+
+/* format("{}:{}", host, port): each {} takes the next argument's text */
+static Value builtin_format(const Call *c) {
+    const Value *fmt = builtin_arg(c, 0);
+    if (fmt->kind != VAL_STRING) builtin_error(c, "expects a format string");
+    const char *f = fmt->sval ? fmt->sval : "";
+
+    /* pass 1 measures, pass 2 writes */
+    char *out = NULL, *p = NULL;
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t n = 0, next = 1;
+        for (const char *s = f; *s; ++s) {
+            if (s[0] == '{' && s[1] == '}') {
+                if (next >= c->nargs) builtin_error(c, "has more {} than arguments");
+                n += builtin_text(c, builtin_arg(c, next++), p, &p);
+                s++;
+                continue;
+            }
+            n++;
+            if (p) *p++ = *s;
+        }
+        if (next < c->nargs) builtin_error(c, "has more arguments than {}");
+        if (!out) { out = malloc(n + 1); p = out; }
+    }
+    *p = '\0';
+    return make_string_owned(out);
+}
+
+static Value builtin_lower(const Call *c) {
+    const Value *v = builtin_arg(c, 0);
+    if (v->kind == VAL_CHAR) return make_char(tolower((unsigned char)v->cval));
+    if (v->kind != VAL_STRING) builtin_error(c, "expects a string");
+    char *s = str_dup_local(v->sval ? v->sval : "");
+    for (char *p = s; *p; ++p) *p = (char)tolower((unsigned char)*p);
+    return make_string_owned(s);
+}
+
+static const Builtin BUILTINS[] = {
+    { "len",      builtin_len,      1, 1 },
+    { "join",     builtin_join,     2, 2 },
+    { "min",      builtin_min,      1, -1 },
+    { "max",      builtin_max,      1, -1 },
+    { "contains", builtin_contains, 2, 2 },
+    { "format",   builtin_format,   1, -1 },
+    { "lower",    builtin_lower,    1, 1 },
+};
+
+static Value call_eval(const Call *c) {
+    return BUILTINS[c->fn].fn(c);
+}
+
+static void print_call(const Call *c) {
+    printf("%s(", BUILTINS[c->fn].name);
+    for (size_t i = 0; i < c->nargs; ++i) {
+        if (i) printf(", ");
+        print_value(&c->args[i]);
+    }
+    printf(")");
+}
+
+/* call := IDENT '(' [value {',' value}] ')' */
+static Value parse_call_value(void) {
+    Token t = cur_token();
+    int fn = -1;
+    for (size_t i = 0; i < sizeof(BUILTINS) / sizeof(BUILTINS[0]); ++i)
+        if (strcmp(BUILTINS[i].name, t.text) == 0) { fn = (int)i; break; }
+    if (fn < 0) parse_error_token(&t, "literal, reference, or builtin (len, join, min, max, contains, format, lower)");
+
+    Call *c = malloc(sizeof(*c));
+    memset(c, 0, sizeof(*c));
+    c->fn = fn;
+    c->pos = t.pos;
+    c->line = t.line;
+    c->col = t.col;
+    consume_token(); /* consume name */
+
+    Token lp = cur_token();
+    if (lp.kind != TOK_LPAREN) parse_error_token(&lp, "'(' after builtin name");
+    consume_token();
+
+    size_t cap = 0;
+    if (cur_token().kind != TOK_RPAREN) {
+        while (1) {
+            if (c->nargs == cap) {
+                cap = cap ? cap * 2 : 4;
+                c->args = realloc(c->args, cap * sizeof(Value));
+            }
+            c->args[c->nargs++] = parse_literal_value_final();
+            Token sep = cur_token();
+            if (sep.kind == TOK_COMMA) { consume_token(); continue; }
+            if (sep.kind == TOK_RPAREN) break;
+            parse_error_token(&sep, "',' or ')' in builtin arguments");
+        }
+    }
+    consume_token(); /* consume ')' */
+
+    const Builtin *b = &BUILTINS[fn];
+    if ((int)c->nargs < b->min_args || (b->max_args >= 0 && (int)c->nargs > b->max_args))
+        builtin_error(c, "called with the wrong number of arguments");
+
+    Value v;
+    memset(&v, 0, sizeof(v));
+    v.kind = VAL_CALL;
+    v.call = c;
+    if (value_is_constant(&v)) {
+        /* constant folding: literal arguments are evaluated right here */
+        Value r = call_eval(c);
+        value_free(&v);
+        return r;
+    }
+    return v;
+}
@@ -19,9 +19,25 @@ void acl_shutdown(void);
 AclBlock *acl_parse_file(const char *path);
 AclBlock *acl_parse_string(const char *text);
 
+/* Experimental: as above, with the lexer on a second thread streaming
+   tokens to the parser. The tree is identical; any speedup needs a free
+   second core and is unmeasured. Prefer acl_parse_file/acl_parse_string. */
+AclBlock *acl_parse_file_pipelined(const char *path);
+AclBlock *acl_parse_string_pipelined(const char *text);
+
 /* Resolve references in-place. Returns 1 on success, 0 on failure. */
 int acl_resolve_all(AclBlock *root);
 
+/* Shared, read-only trees.
+   acl_open_shared parses and resolves `path` once per process and hands out
+   references to the same tree for as long as the file's inode, mtime and size
+   are unchanged. Concurrent openers of the same file wait for a single parse.
+   The returned tree is frozen: do not modify it or pass it to acl_free; drop
+   each reference with acl_release_shared, the last release frees it.
+   Returns NULL if the file cannot be stat'ed or parsed. */
+AclBlock *acl_open_shared(const char *path);
+void acl_release_shared(AclBlock *root);
+
 /* Utilities */
 void acl_print(AclBlock *root, FILE *out);
 
@@ -49,10 +65,95 @@ void acl_error_free(AclError *err);
 */
 AclValue *acl_find_value_by_path(AclBlock *root, const char *path);
 
+/* Block handles.
+   A `ref` field whose path ends on a block, e.g.
+     ref primary = $Network.interface["eth0"];
+   resolves to a direct handle to that block. Paths may step through such
+   fields ("Services.service[\"netd\"].primary.gateway"), and through the
+   elements of a `ref[]` array by index ("...links[1].gateway").
+   acl_get_block returns the block a path names (a child block or a `ref`
+   field holding one); the acl_block_* variants take paths relative to a
+   block, such as one returned by acl_get_block. The returned blocks belong
+   to the tree. */
+AclBlock *acl_get_block(AclBlock *root, const char *path);
+AclBlock *acl_block_get_block(AclBlock *block, const char *path);
+AclValue *acl_block_find_value(AclBlock *block, const char *path);
+
+/* Array access. Large array literals are syntax-checked when parsed but kept
+   undecoded, and are decoded (once) by the first of these calls or an
+   indexed path lookup.
+   acl_array_next returns the first element for prev == NULL and NULL after
+   the last; both return 0/NULL if `array` is not an array. */
+size_t acl_array_length(AclValue *array);
+AclValue *acl_array_next(AclValue *array, AclValue *prev);
+
 /* Typed getters now use array-index aware lookup (same behavior as before) */
 int acl_get_int(AclBlock *root, const char *path, long *out);
 int acl_get_float(AclBlock *root, const char *path, double *out);
 int acl_get_bool(AclBlock *root, const char *path, int *out);
 int acl_get_string(AclBlock *root, const char *path, char **out);
 
+/* Schema validation.
+   A schema is an ACL file mirroring the configs it describes; blocks stand
+   for config blocks of the same name and `field "name" { ... }` blocks
+   describe fields:
+
+     Logging {
+         bool required = true;
+         field "level" { string type = "string"; one_of = { "DEBUG", "INFO", "WARN", "ERROR" }; default = "INFO"; }
+     }
+     Users {
+         user {
+             bool unique_labels = true;
+             field "uid" { string type = "int"; bool required = true; int min = 0; int max = 65535; }
+         }
+     }
+
+   `type = "ref"` accepts any field declared `ref`, whatever it resolved to.
+   acl_schema_compile rejects (NULL) a schema whose `default` fails its own
+   field's type, min/max or one_of.
+   acl_schema_validate checks a resolved tree in one traversal, appends
+   defaults for missing fields that have one, and returns the number of
+   violations. If `errors` is non-NULL it receives a heap array of that many
+   AclError (code + message) to release with acl_schema_errors_free.
+   The tree is modified, so do not validate trees from acl_open_shared. */
+typedef struct AclSchema AclSchema;
+
+enum {
+    ACL_SCHEMA_MISSING_FIELD = 1,
+    ACL_SCHEMA_MISSING_BLOCK,
+    ACL_SCHEMA_TYPE,
+    ACL_SCHEMA_RANGE,
+    ACL_SCHEMA_ENUM,
+    ACL_SCHEMA_DUPLICATE_LABEL,
+    ACL_SCHEMA_NO_MEMORY
+};
+
+AclSchema *acl_schema_load(const char *path);
+AclSchema *acl_schema_compile(AclBlock *schema_root); /* schema_root must outlive the result */
+size_t acl_schema_validate(const AclSchema *schema, AclBlock *root, AclError **errors);
+void acl_schema_errors_free(AclError *errors, size_t n);
+void acl_schema_free(AclSchema *schema);
+
+/* Spawn helpers.
+   acl_block_to_envp turns each field of `block` into "PREFIXname=value"
+   (prefix may be NULL); acl_block_to_argv builds { exec, args... } from a
+   string field `exec_field` and an optional array (or scalar) field
+   `args_field`. Ints, floats, bools and chars are formatted as text, arrays
+   of scalars are joined with ','; fields holding references, blocks, empty
+   arrays or arrays with any non-scalar element are skipped.
+   The result is one allocation: the NULL-terminated vector followed by its
+   strings. It is carved from `arena` if given (valid until the arena is
+   reset or freed), otherwise malloc'd and released with a single free(). */
+typedef struct AclArena { struct AclArenaChunk *head; } AclArena;  /* zero-initialize */
+
+#define ACL_ENV_UPPERCASE    0x1  /* upper-case field names: exec -> EXEC */
+#define ACL_ENV_BOOL_WORDS   0x2  /* bools as "true"/"false" instead of "1"/"0" */
+#define ACL_ENV_ARRAY_COLON  0x4  /* join arrays with ':' instead of ',' */
+
+char **acl_block_to_envp(AclBlock *block, const char *prefix, int flags, AclArena *arena);
+char **acl_block_to_argv(AclBlock *block, const char *exec_field, const char *args_field, AclArena *arena);
+void acl_arena_reset(AclArena *arena);  /* drop all results, keep memory for reuse */
+void acl_arena_free(AclArena *arena);
+
 #endif